@@ -20,7 +20,7 @@ void EchoSession::dataAvailable() {
   mtx.unlock();
 }
 
-Session* EchoServer::createSession(const int socket, const sockaddr_in peer_address) {
-  EchoSession* session = new EchoSession(epoll(),*this,socket,peer_address);
+Session* EchoServer::createSession(EPoll &epoll, const int socket, const sockaddr_in peer_address) {
+  EchoSession* session = new EchoSession(epoll,*this,socket,peer_address);
   return dynamic_cast<Session*>(session); 
 }
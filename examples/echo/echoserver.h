@@ -11,7 +11,7 @@ class EchoServer : public tcp::Server {
   public:
     EchoServer(EPoll &epoll, SSLContext *ctx, const int domain = AF_INET) : Server(epoll,ctx,domain) {}
   protected:
-    Session* createSession(const int socket, const sockaddr_in peer_address) override;
+    Session* createSession(EPoll &epoll, const int socket, const sockaddr_in peer_address) override;
 };
 
 /** @brief   A Session that echos back whatever data it recieves
@@ -5,7 +5,6 @@
 #include "echoserver.h"
 #include "serveroptions.h"
 
-EPoll epoll;
 ProgramOptions options;
 bool terminated {false};
 
@@ -79,18 +78,25 @@ int main(int argc, char** argv) {
     ctx = new SSLContext(SSLMode::SERVER);
   }
   int domain = options.ip6 ? AF_INET6 : AF_INET;
+  EPoll epoll(options.uring ? EPollBackend::IO_URING : EPollBackend::EPOLL, options.edge);
   EchoServer server(epoll,ctx,domain);
   if (useSSL) {
     initSSLFromOptions(server,options);
   }
-  server.start(options.port,options.interface.c_str(),useSSL);
-  if (!server.listening()) {
+  if (options.threads > 0) {
+    server.setThreads(options.threads);
+    server.setSharding(options.shard || options.steer,options.steer);
+  }
+  if (options.workers > 0) {
+    server.setWorkers(options.workers);
+  }
+  if (!server.start(options.port,options.interface.c_str(),useSSL)) {
     cerr << "Failed to start server" << endl;
     closeSSL(&ctx);
     return EXIT_FAILURE;
   }
   while (server.listening() && !terminated) {
-    epoll.poll(100);
+    epoll.poll(-1);
   }
   closeSSL(&ctx);
   return EXIT_SUCCESS;
@@ -24,6 +24,12 @@ void ProgramOptions::setup()
     ("log,l", po::value<string>(&log), "Log filename")
     ("verbose,V", po::bool_switch(&verbose), "Verbose logging")
     ("ip6", po::bool_switch(&ip6), "Use IPv6 protocol")
+    ("threads,t", po::value<size_t>(&threads), "Number of session threads (0 = handle sessions on the main thread)")
+    ("workers", po::value<size_t>(&workers), "Number of worker threads running dataAvailable() (0 = run on the session threads)")
+    ("shard", po::bool_switch(&shard), "Open one SO_REUSEPORT listener per session thread")
+    ("steer", po::bool_switch(&steer), "Pin session threads to CPUs and steer connections to the receiving CPU (implies --shard)")
+    ("uring", po::bool_switch(&uring), "Use the io_uring backend instead of epoll")
+    ("edge", po::bool_switch(&edge), "Register sockets with epoll in edge triggered mode")
   ;
 
   ssl.add_options()
@@ -180,6 +186,12 @@ void ProgramOptions::dump()
   cout << "port=" << port << endl;
   cout << "log=" << log << endl;
   cout << "verbose=" << verbose << endl;
+  cout << "threads=" << threads << endl;
+  cout << "workers=" << workers << endl;
+  cout << "shard=" << shard << endl;
+  cout << "steer=" << steer << endl;
+  cout << "uring=" << uring << endl;
+  cout << "edge=" << edge << endl;
   cout << "certfile=" << certfile << endl;
   cout << "keyfile=" << keyfile << endl;
   cout << "keypass=" << keypass << endl;
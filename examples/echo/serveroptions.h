@@ -40,6 +40,12 @@ class ProgramOptions {
     string log {};
     bool verbose {false};
     bool ip6 {false};
+    size_t threads {0};
+    size_t workers {0};
+    bool shard {false};
+    bool steer {false};
+    bool uring {false};
+    bool edge {false};
     
     // SSL Options
     string certfile {};
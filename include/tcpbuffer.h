@@ -0,0 +1,203 @@
+/** @file    tcpbuffer.h
+ *  @brief   A chunked byte buffer used for DataSocket input and output
+ *  @details Data is stored in a linked list of fixed size blocks. Appending, consuming and copying
+ *           out work a block at a time, and the readable data can be exported as an iovec array for
+ *           scatter/gather I/O without copying it. A SharedBuffer can be appended by reference, so
+ *           the same data can be queued on many buffers while only one copy of it is held in memory.
+ *           Blocks can be drawn from a BlockPool instead of the heap.
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_BUFFER_H
+#define TCP_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <sys/uio.h>
+#include "tcppool.h"
+
+namespace tcp {
+
+using namespace std;
+
+/** @brief   An immutable, reference counted slice of bytes
+ *  @details Copies of a SharedBuffer refer to the same memory, which is freed when the last copy is
+ *           destroyed. The reference count is atomic, so copies may be held and released by different
+ *           threads. Pass one to DataSocket.write() to send the same data to many sockets. */
+class SharedBuffer {
+  public:
+    /** @brief Constructs an empty buffer */
+    SharedBuffer() {}
+
+    /** @brief Constructs a buffer holding a copy of size bytes from data */
+    SharedBuffer(const void *data, size_t size);
+
+    /** @brief Constructs a buffer that takes ownership of data without copying it */
+    SharedBuffer(vector<uint8_t> &&data);
+
+    /** @brief Returns a pointer to the first byte of the slice */
+    const uint8_t *data() const { return data_ ? data_->data() + offset_ : nullptr; }
+
+    /** @brief Returns the number of bytes in the slice */
+    size_t size() const { return size_; }
+
+    /** @brief Returns true if the slice holds no data */
+    bool empty() const { return size_ == 0; }
+
+    /** @brief   Returns a buffer that refers to part of this one without copying it
+     *  @details offset and size are clipped to the bounds of this slice */
+    SharedBuffer slice(size_t offset, size_t size = SIZE_MAX) const;
+  private:
+    shared_ptr<const vector<uint8_t>> data_;
+    size_t offset_ {0};
+    size_t size_ {0};
+};
+
+/** @brief   A FIFO byte buffer made up of fixed size blocks
+ *  @details The buffer is not thread safe. DataSocket protects its buffers with the socket mutex.
+ *           One empty block is kept in reserve so that a buffer that is repeatedly filled and drained
+ *           does not allocate. A buffer that draws its blocks from a BlockPool returns empty blocks
+ *           to the pool instead. */
+class ByteBuffer {
+  public:
+    static const size_t DEFAULT_BLOCK_SIZE = 16384; /**< Default block size in bytes */
+    static const size_t SHARED_COPY_SIZE = 1024;    /**< SharedBuffers up to this size are copied by append() */
+    static const size_t NOT_FOUND = SIZE_MAX;       /**< Returned by find() when the byte is not in the buffer */
+
+    /** @brief Constructor
+     *  @param blockSize The size of each block in bytes
+     *  @param pool      The pool to allocate blocks from, or nullptr to use the heap. The pool is only 
+     *                   used if its size() is allocationSize(blockSize) and must outlive the buffer. */
+    ByteBuffer(size_t blockSize = DEFAULT_BLOCK_SIZE, BlockPool *pool = nullptr);
+
+    /** @brief   Destructor
+     *  @details Blocks that are still pinned are not freed, because the kernel may still read them */
+    ~ByteBuffer();
+
+    ByteBuffer(const ByteBuffer&) = delete;
+    ByteBuffer& operator=(const ByteBuffer&) = delete;
+
+    /** @brief Returns the number of bytes in the buffer */
+    size_t size() const { return size_; }
+
+    /** @brief Returns true if the buffer holds no data */
+    bool empty() const { return size_ == 0; }
+
+    /** @brief Appends size bytes from data to the end of the buffer */
+    void append(const void *data, size_t size);
+
+    /** @brief   Appends a reference to the data in buffer to the end of the buffer
+     *  @details Slices larger than SHARED_COPY_SIZE are not copied. The buffer holds a reference to them 
+     *           until they have been consumed. Smaller slices are copied, which is cheaper than tracking 
+     *           them separately. */
+    void append(const SharedBuffer &buffer);
+
+    /** @brief   Returns a pointer to the first size bytes of the buffer without copying them
+     *  @details The pointer remains valid until the buffer is next modified
+     *  @returns nullptr if fewer than size bytes are held, or if they are not stored contiguously */
+    const uint8_t *contiguous(size_t size) const;
+
+    /** @brief   Copies up to size bytes, starting offset bytes from the front of the buffer, into data
+     *  @details The buffer is not modified
+     *  @returns The number of bytes copied */
+    size_t peek(void *data, size_t size, size_t offset = 0) const;
+
+    /** @brief   Returns the position of the first occurrence of byte at or after offset bytes from the front
+     *  @details Each block is searched with findByte(), which compares 16 or 32 bytes per instruction
+     *  @returns The offset of the byte from the front of the buffer, or NOT_FOUND */
+    size_t find(uint8_t byte, size_t offset = 0) const;
+
+    /** @brief   Copies up to size bytes from the front of the buffer into data and removes them
+     *  @returns The number of bytes read */
+    size_t read(void *data, size_t size);
+
+    /** @brief   Removes up to size bytes from the front of the buffer
+     *  @returns The number of bytes removed */
+    size_t consume(size_t size);
+
+    /** @brief   Removes all data from the buffer
+     *  @details Pinned blocks are kept until they are unpinned. If no pins are outstanding, the numbering
+     *           of pins starts again from 0. */
+    void clear();
+
+    /** @brief   Describes at least size bytes of free space at the end of the buffer as an iovec array
+     *  @details Blocks are allocated as needed and are only added to the buffer by commit(). Use this 
+     *           to read directly into the buffer with readv(). The iovecs remain valid until the buffer 
+     *           is next modified.
+     *  @param   size  [in]  The number of bytes of space required
+     *  @param   iov   [out] The array to fill
+     *  @param   count [in]  The number of entries in iov. Less space is returned if count is too small.
+     *  @returns The number of entries used */
+    size_t reserve(size_t size, struct iovec *iov, size_t count);
+
+    /** @brief   Appends size bytes that were written into the space returned by the last call to reserve() */
+    void commit(size_t size);
+
+    /** @brief   Describes the data at the front of the buffer as an iovec array without copying it
+     *  @details The iovecs remain valid until the buffer is next modified
+     *  @param   iov   [out] The array to fill
+     *  @param   count [in]  The number of entries in iov
+     *  @param   limit [in]  The maximum number of bytes to describe
+     *  @returns The number of entries used */
+    size_t iovecs(struct iovec *iov, size_t count, size_t limit = SIZE_MAX) const;
+
+    /** @brief   Holds the blocks that store the first size bytes of the buffer until unpin() is called
+     *  @details Used for MSG_ZEROCOPY sends, where the kernel reads the data after sendmsg() returns.
+     *           The data can be consumed as usual, but the blocks are neither freed nor reused while 
+     *           they are pinned. Pins are numbered consecutively from 0, like zerocopy sends.
+     *  @returns The number of the pin */
+    uint32_t pin(size_t size);
+
+    /** @brief   Releases the pins numbered first to last inclusive */
+    void unpin(uint32_t first, uint32_t last);
+
+    /** @brief   Returns the number of pins that have not been released */
+    size_t pinned() const { return pins_.size(); }
+
+    /** @brief Returns the number of bytes allocated for each block of a buffer with the given block size */
+    static size_t allocationSize(size_t blockSize = DEFAULT_BLOCK_SIZE) { return sizeof(Block) + blockSize; }
+  private:
+    struct Block {
+      Block *next;
+      uint8_t *base;  /**< data() for an owned block, or the memory of the SharedBuffer it refers to */
+      size_t begin;
+      size_t end;
+      BlockPool *pool; /**< The pool the block was allocated from, or nullptr if it came from the heap */
+      unsigned pins;  /**< The number of pins that hold the block */
+      bool retired;   /**< True if the block has been consumed but is still pinned */
+      bool shared;    /**< If true, data() holds a SharedBuffer and the block is never written to */
+      uint8_t *data() { return reinterpret_cast<uint8_t*>(this + 1); }
+    };
+    Block *create();
+    void destroy(Block *block);
+    Block *allocate();
+    size_t space(const Block *block) const { return block->shared ? 0 : blockSize_ - block->end; }
+    void release(Block *block);
+    void retire(Block *block);
+    void link(Block *block);
+    void trim();
+    Block *head_ {nullptr};
+    Block *tail_ {nullptr};
+    Block *spare_ {nullptr};  /**< Empty blocks, linked through next */
+    size_t spareCount_ {0};
+    size_t size_ {0};
+    size_t blockSize_;
+    /** @brief The blocks held by a call to pin() */
+    struct Pin {
+      uint32_t id;
+      vector<Block*> blocks;
+    };
+    deque<Pin> pins_;
+    uint32_t nextPin_ {0};
+    BlockPool *pool_;
+};
+
+} // namespace tcp
+
+#endif // include guard
@@ -0,0 +1,357 @@
+/** @file    tcpframing.h
+ *  @brief   Length prefixed and delimited message framing for Session and Client
+ *  @details FramedSession and FramedClient parse frames straight out of the inputBuffer and deliver each
+ *           complete message to messageReceived(). A message that arrived in one block is passed without
+ *           copying it. The header format is a template parameter: a fixed 2, 4 or 8 byte length in big
+ *           or little endian order, or an unsigned LEB128 varint. DelimitedSession and DelimitedClient do
+ *           the same for records terminated by a delimiter byte, such as lines of text.
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_FRAMING_H
+#define TCP_FRAMING_H
+
+#include <cstdint>
+#include <vector>
+#include <sys/socket.h>
+#include "tcpsocket.h"
+#include "tcpserver.h"
+#include "tcpclient.h"
+
+namespace tcp {
+
+using namespace std;
+
+/** @brief   A header holding the message length as a fixed size unsigned integer
+ *  @details Header formats provide MAX_SIZE, decode() and encode(). decode() returns the size of the header
+ *           and sets length, or returns 0 if more data is needed. encode() writes the header for length
+ *           and returns its size. */
+template<typename T, bool BigEndian>
+struct FixedLengthHeader {
+  static const size_t MAX_SIZE = sizeof(T); /**< The largest header in bytes */
+
+  /** @brief Reads a header from the size bytes at data */
+  static size_t decode(const uint8_t *data, size_t size, uint64_t &length)
+  {
+    if (size < sizeof(T)) {
+      return 0;
+    }
+    length = 0;
+    for (size_t i=0;i<sizeof(T);++i) {
+      length |= (uint64_t)data[BigEndian ? i : sizeof(T) - 1 - i] << (8 * (sizeof(T) - 1 - i));
+    }
+    return sizeof(T);
+  }
+
+  /** @brief Writes the header for length to data, which must hold MAX_SIZE bytes */
+  static size_t encode(uint64_t length, uint8_t *data)
+  {
+    for (size_t i=0;i<sizeof(T);++i) {
+      data[BigEndian ? i : sizeof(T) - 1 - i] = (uint8_t)(length >> (8 * (sizeof(T) - 1 - i)));
+    }
+    return sizeof(T);
+  }
+
+  /** @brief Returns the largest length the header can hold */
+  static uint64_t limit() { return (T)~(T)0; }
+};
+
+typedef FixedLengthHeader<uint16_t,true> BigEndian16Header;     /**< 2 byte network order length */
+typedef FixedLengthHeader<uint32_t,true> BigEndian32Header;     /**< 4 byte network order length */
+typedef FixedLengthHeader<uint64_t,true> BigEndian64Header;     /**< 8 byte network order length */
+typedef FixedLengthHeader<uint16_t,false> LittleEndian16Header; /**< 2 byte little endian length */
+typedef FixedLengthHeader<uint32_t,false> LittleEndian32Header; /**< 4 byte little endian length */
+typedef FixedLengthHeader<uint64_t,false> LittleEndian64Header; /**< 8 byte little endian length */
+
+/** @brief   A header holding the message length as an unsigned LEB128 varint
+ *  @details Seven bits of the length are stored per byte, least significant first, with the top bit set
+ *           on every byte but the last. A header longer than MAX_SIZE decodes to a length of UINT64_MAX,
+ *           which exceeds any maximum frame size. */
+struct VarintHeader {
+  static const size_t MAX_SIZE = 10; /**< The largest header in bytes */
+
+  /** @brief Reads a header from the size bytes at data */
+  static size_t decode(const uint8_t *data, size_t size, uint64_t &length)
+  {
+    length = 0;
+    for (size_t i=0;(i < size) && (i < MAX_SIZE);++i) {
+      length |= (uint64_t)(data[i] & 0x7F) << (7 * i);
+      if ((data[i] & 0x80) == 0) {
+        return i + 1;
+      }
+    }
+    if (size >= MAX_SIZE) {
+      length = UINT64_MAX;
+      return MAX_SIZE;
+    }
+    return 0;
+  }
+
+  /** @brief Writes the header for length to data, which must hold MAX_SIZE bytes */
+  static size_t encode(uint64_t length, uint8_t *data)
+  {
+    size_t result = 0;
+    while (length >= 0x80) {
+      data[result++] = (uint8_t)(length | 0x80);
+      length >>= 7;
+    }
+    data[result++] = (uint8_t)length;
+    return result;
+  }
+
+  /** @brief Returns the largest length the header can hold */
+  static uint64_t limit() { return UINT64_MAX; }
+};
+
+/** @brief   Adds length prefixed framing to a DataSocket descendant
+ *  @details Base is Session or Client. Descendants override messageReceived() instead of dataAvailable().
+ *           Every complete frame in the inputBuffer is delivered on each read event. The socket mutex is
+ *           held while messageReceived() is called. Use FramedSession and FramedClient rather than this
+ *           class directly. reset() is not declared override because only Session defines it. */
+template<typename Header, typename Base>
+class FramedSocket : public Base {
+  public:
+    using Base::Base;
+
+    static const size_t DEFAULT_MAX_FRAME_SIZE = 16777216; /**< Default value of maxFrameSize() */
+
+    /** @brief   Sets the largest message that will be accepted. See frameTooLarge(). */
+    void setMaxFrameSize(size_t size) { maxFrameSize_ = size; }
+
+    /** @brief   Returns the largest message that will be accepted */
+    size_t maxFrameSize() const { return maxFrameSize_; }
+
+    /** @brief   Writes a header and size bytes from data as one frame
+     *  @details The header and message are written as a single batch. See DataSocket.cork().
+     *  @returns False if size cannot be represented by the header or not all of the frame was queued */
+    bool writeMessage(const void *data, size_t size)
+    {
+      uint8_t header[Header::MAX_SIZE];
+      if (size > Header::limit()) {
+        return false;
+      }
+      size_t length = Header::encode(size,header);
+      DataSocket::Batch batch(*this);
+      return (this->write(header,length) == length) && (this->write(data,size) == size);
+    }
+
+    /** @brief   Writes a header and a reference to the contents of buffer as one frame
+     *  @details See DataSocket.write(const SharedBuffer&) */
+    bool writeMessage(const SharedBuffer &buffer)
+    {
+      uint8_t header[Header::MAX_SIZE];
+      if (buffer.size() > Header::limit()) {
+        return false;
+      }
+      size_t length = Header::encode(buffer.size(),header);
+      DataSocket::Batch batch(*this);
+      return (this->write(header,length) == length) && (this->write(buffer) == buffer.size());
+    }
+
+  protected:
+    /** @brief   Called once for each complete message received
+     *  @details data is only valid until messageReceived() returns. It points into the inputBuffer when
+     *           the message is stored contiguously, and into a scratch buffer otherwise. */
+    virtual void messageReceived(const uint8_t *data, size_t size) = 0;
+
+    /** @brief   Called when a header announces a message larger than maxFrameSize()
+     *  @details The stream cannot be resynchronised, so the default implementation logs an error and shuts
+     *           the socket down. The disconnect is then handled by the next epoll event. Input received
+     *           afterwards is discarded. */
+    virtual void frameTooLarge(uint64_t size)
+    {
+      error("FramedSocket","Frame of " + to_string(size) + " bytes exceeds the maximum of " + to_string(maxFrameSize_));
+      ::shutdown(this->socket(),SHUT_RDWR);
+    }
+
+    /** @brief   Parses every complete frame in the inputBuffer */
+    void dataAvailable() override
+    {
+      this->mtx.lock();
+      while (!failed_) {
+        uint8_t header[Header::MAX_SIZE];
+        uint64_t length;
+        size_t size = Header::decode(header,this->peek(header,Header::MAX_SIZE),length);
+        if (size == 0) {
+          break;
+        }
+        if (length > maxFrameSize_) {
+          failed_ = true;
+          frameTooLarge(length);
+          break;
+        }
+        if (this->available() < size + length) {
+          break;
+        }
+        const uint8_t *message = this->view(size + length);
+        if (message) {
+          message += size;
+        } else {
+          // The frame spans blocks
+          scratch_.resize(length);
+          this->peek(scratch_.data(),length,size);
+          message = scratch_.data();
+        }
+        messageReceived(message,length);
+        this->consume(size + length);
+      }
+      if (failed_) {
+        this->consume(this->available());
+      }
+      this->mtx.unlock();
+    }
+
+    /** @brief   Discards the parser state when a pooled session is reused. See Session.reset().
+     *  @details The maximum frame size is kept. A descendant that overrides reset() must call this one. */
+    void reset()
+    {
+      Base::reset();
+      failed_ = false;
+      scratch_.clear();
+      scratch_.shrink_to_fit();
+    }
+
+  private:
+    size_t maxFrameSize_ {DEFAULT_MAX_FRAME_SIZE};
+    bool failed_ {false};
+    vector<uint8_t> scratch_;
+};
+
+/** @brief   A Session that sends and receives length prefixed messages
+ *  @details Derive from FramedSession<Header> and override messageReceived(). For example
+ *           `class MySession : public FramedSession<BigEndian32Header>` */
+template<typename Header>
+using FramedSession = FramedSocket<Header,Session>;
+
+/** @brief   A Client that sends and receives length prefixed messages */
+template<typename Header>
+using FramedClient = FramedSocket<Header,Client>;
+
+/** @brief   Splits the received data of a DataSocket descendant into records ending in a delimiter byte
+ *  @details Base is Session or Client. Descendants override recordReceived() instead of dataAvailable().
+ *           The inputBuffer is searched with DataSocket.find(), and the position reached is remembered 
+ *           across read events so that a long record arriving in many pieces is only searched once. The
+ *           socket mutex is held while recordReceived() is called. Use DelimitedSession and
+ *           DelimitedClient rather than this class directly. */
+template<typename Base>
+class DelimitedSocket : public Base {
+  public:
+    using Base::Base;
+
+    static const size_t DEFAULT_MAX_RECORD_SIZE = 65536; /**< Default value of maxRecordSize() */
+
+    /** @brief   Sets the byte that ends each record. The default is '\n'. */
+    void setDelimiter(uint8_t delimiter) { delimiter_ = delimiter; }
+
+    /** @brief   Returns the byte that ends each record */
+    uint8_t delimiter() const { return delimiter_; }
+
+    /** @brief   If true, a carriage return before the delimiter is removed from the record. The default is true. */
+    void setStripCR(bool value) { stripCR_ = value; }
+
+    /** @brief   Returns true if a carriage return before the delimiter is removed */
+    bool stripCR() const { return stripCR_; }
+
+    /** @brief   Sets the largest record, excluding the delimiter, that will be accepted. See recordTooLarge(). */
+    void setMaxRecordSize(size_t size) { maxRecordSize_ = size; }
+
+    /** @brief   Returns the largest record that will be accepted */
+    size_t maxRecordSize() const { return maxRecordSize_; }
+
+    /** @brief   Writes size bytes from data followed by the delimiter as one batch */
+    bool writeRecord(const void *data, size_t size)
+    {
+      DataSocket::Batch batch(*this);
+      return (this->write(data,size) == size) && (this->write(&delimiter_,1) == 1);
+    }
+
+  protected:
+    /** @brief   Called once for each complete record received
+     *  @details The delimiter is not included. data is only valid until recordReceived() returns. It points
+     *           into the inputBuffer when the record is stored contiguously, and into a scratch buffer 
+     *           otherwise. */
+    virtual void recordReceived(const uint8_t *data, size_t size) = 0;
+
+    /** @brief   Called when more than maxRecordSize() bytes have been received without a delimiter
+     *  @details The default implementation logs an error and shuts the socket down. Input received 
+     *           afterwards is discarded. */
+    virtual void recordTooLarge(size_t size)
+    {
+      error("DelimitedSocket","Record of at least " + to_string(size) + " bytes exceeds the maximum of " + to_string(maxRecordSize_));
+      ::shutdown(this->socket(),SHUT_RDWR);
+    }
+
+    /** @brief   Delivers every complete record in the inputBuffer */
+    void dataAvailable() override
+    {
+      this->mtx.lock();
+      while (!failed_) {
+        size_t position = this->find(delimiter_,scanned_);
+        if (position == ByteBuffer::NOT_FOUND) {
+          scanned_ = this->available();
+          if (scanned_ > maxRecordSize_) {
+            failed_ = true;
+            recordTooLarge(scanned_);
+          }
+          break;
+        }
+        if (position > maxRecordSize_) {
+          failed_ = true;
+          recordTooLarge(position);
+          break;
+        }
+        const uint8_t *record = this->view(position + 1);
+        if (!record) {
+          // The record spans blocks
+          scratch_.resize(position);
+          this->peek(scratch_.data(),position);
+          record = scratch_.data();
+        }
+        size_t size = position;
+        if (stripCR_ && (size > 0) && (record[size - 1] == '\r')) {
+          --size;
+        }
+        recordReceived(record,size);
+        this->consume(position + 1);
+        scanned_ = 0;
+      }
+      if (failed_) {
+        this->consume(this->available());
+      }
+      this->mtx.unlock();
+    }
+
+    /** @brief   Discards the parser state when a pooled session is reused. See Session.reset().
+     *  @details The delimiter and other settings are kept. A descendant that overrides reset() must call 
+     *           this one. */
+    void reset()
+    {
+      Base::reset();
+      scanned_ = 0;
+      failed_ = false;
+      scratch_.clear();
+      scratch_.shrink_to_fit();
+    }
+
+  private:
+    size_t maxRecordSize_ {DEFAULT_MAX_RECORD_SIZE};
+    size_t scanned_ {0};      /**< Bytes at the front of the inputBuffer known not to hold the delimiter */
+    uint8_t delimiter_ {'\n'};
+    bool stripCR_ {true};
+    bool failed_ {false};
+    vector<uint8_t> scratch_;
+};
+
+/** @brief   A Session that receives records ending in a delimiter, such as lines of text
+ *  @details Derive from DelimitedSession and override recordReceived() */
+using DelimitedSession = DelimitedSocket<Session>;
+
+/** @brief   A Client that receives records ending in a delimiter, such as lines of text */
+using DelimitedClient = DelimitedSocket<Client>;
+
+} // namespace tcp
+
+#endif // include guard
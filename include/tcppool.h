@@ -0,0 +1,146 @@
+/** @file    tcppool.h
+ *  @brief   A slab allocator for the blocks used by DataSocket input and output buffers
+ *  @details Each EPoll instance owns a BlockPool. Blocks are carved out of 2 MiB slabs that are mapped
+ *           with mmap() and may be backed by huge pages. The thread that is polling the EPoll instance
+ *           allocates and frees blocks without locking. Blocks freed on any other thread are pushed
+ *           onto a lock free list that the polling thread reclaims, and allocations made on any other
+ *           thread are served from the heap.
+ *  @remarks Applications do not normally use this class directly. Use EPoll.pool() to configure it.
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_POOL_H
+#define TCP_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tcp {
+
+using namespace std;
+
+/** @brief   Determines how the slabs of a BlockPool are backed
+ *  @details TRANSPARENT asks for transparent huge pages with madvise(MADV_HUGEPAGE). EXPLICIT maps slabs
+ *           with MAP_HUGETLB, which requires huge pages to have been reserved, and falls back to
+ *           TRANSPARENT if none are available. */
+enum class HugePages {NONE=0, TRANSPARENT, EXPLICIT};
+
+/** @brief   Counters describing the state of a BlockPool */
+struct BlockPoolStats {
+  uint64_t hits;      /**< Allocations served from free blocks already held by the pool */
+  uint64_t misses;    /**< Allocations that mapped a new slab or were served from the heap */
+  size_t bytesHeld;   /**< Bytes of slab memory currently mapped */
+  size_t bytesInUse;  /**< Bytes of slab memory currently allocated to buffers */
+};
+
+/** @brief   A pool of fixed size blocks carved out of large slabs
+ *  @details The pool is only used without locking by the thread that entered a BlockPool::Scope for it,
+ *           which EPoll.poll() does. allocate() returns nullptr on other threads, or when the pool has
+ *           reached its limit, and the caller falls back to the heap. release() may be called on any
+ *           thread. Slabs that become empty are unmapped while the pool holds more free memory than
+ *           the trim threshold. */
+class BlockPool {
+  public:
+    static const size_t SLAB_SIZE = 2097152;                /**< The size of each slab, which is also the huge page size */
+    static const size_t DEFAULT_LIMIT = 64 * SLAB_SIZE;     /**< Default value of limit() */
+    static const size_t DEFAULT_TRIM_THRESHOLD = 4 * SLAB_SIZE; /**< Default value of trimThreshold() */
+
+    /** @brief   Makes pool the pool that the calling thread allocates from until the scope ends */
+    class Scope {
+      public:
+        Scope(BlockPool &pool);
+        ~Scope();
+      private:
+        BlockPool *previous_;
+    };
+
+    /** @brief Constructor
+     *  @param size The size of each block in bytes */
+    BlockPool(size_t size);
+
+    /** @brief   Destructor. Unmaps every slab.
+     *  @details Every block must have been released first */
+    ~BlockPool();
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    /** @brief Returns the size of each block in bytes */
+    size_t size() const { return size_; }
+
+    /** @brief   Returns a block, or nullptr if the calling thread should allocate from the heap instead */
+    void *allocate();
+
+    /** @brief   Returns a block obtained from allocate() to the pool
+     *  @details May be called on any thread */
+    void release(void *block);
+
+    /** @brief   Unmaps every empty slab
+     *  @details Blocks released on other threads are reclaimed first. Must be called on the thread that
+     *           uses the pool. */
+    void trim();
+
+    /** @brief   Sets the maximum number of bytes of slab memory the pool will map. 0 disables the pool. */
+    void setLimit(size_t bytes) { limit_ = bytes; }
+
+    /** @brief   Returns the maximum number of bytes of slab memory the pool will map */
+    size_t limit() const { return limit_; }
+
+    /** @brief   Empty slabs are unmapped while the pool holds more than this many bytes of free blocks */
+    void setTrimThreshold(size_t bytes) { trimThreshold_ = bytes; }
+
+    /** @brief   Returns the trim threshold in bytes */
+    size_t trimThreshold() const { return trimThreshold_; }
+
+    /** @brief   Sets how slabs mapped from now on are backed */
+    void setHugePages(HugePages mode) { hugePages_ = mode; }
+
+    /** @brief   Returns how new slabs are backed */
+    HugePages hugePages() const { return hugePages_; }
+
+    /** @brief   Returns the pool counters. May be called on any thread. */
+    BlockPoolStats stats() const;
+
+    /** @brief   Returns true if the calling thread allocates from this pool */
+    bool owned() const;
+  private:
+    struct Slab {
+      Slab *next;       /**< Next slab with free blocks */
+      Slab *prev;
+      void *free;       /**< Free blocks in this slab, linked through their first word */
+      size_t used;      /**< Blocks allocated from this slab */
+      size_t index;     /**< Position in slabs_ */
+      bool listed;      /**< True if the slab is in the list of slabs with free blocks */
+    };
+    Slab *map();
+    void unmap(Slab *slab);
+    void free(void *block);
+    void reclaim();
+    void list(Slab *slab);
+    void unlist(Slab *slab);
+    Slab *slabOf(void *block) const { return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(block) & ~(uintptr_t)(SLAB_SIZE - 1)); }
+    size_t size_;
+    size_t stride_;     /**< Distance between blocks, a multiple of the cache line size */
+    size_t offset_;     /**< Offset of the first block from the start of a slab */
+    size_t capacity_;   /**< Blocks per slab */
+    size_t limit_ {DEFAULT_LIMIT};
+    size_t trimThreshold_ {DEFAULT_TRIM_THRESHOLD};
+    HugePages hugePages_ {HugePages::NONE};
+    Slab *partial_ {nullptr};   /**< Slabs with free blocks */
+    vector<Slab*> slabs_;       /**< Every mapped slab */
+    size_t freeBlocks_ {0};
+    atomic<void*> returned_ {nullptr};  /**< Blocks released on other threads, linked through their first word */
+    atomic<uint64_t> hits_ {0};
+    atomic<uint64_t> misses_ {0};
+    atomic<size_t> bytesHeld_ {0};
+    atomic<size_t> bytesInUse_ {0};
+};
+
+} // namespace tcp
+
+#endif // include guard
@@ -0,0 +1,35 @@
+/** @file    tcpscan.h
+ *  @brief   Vectorised byte search used to find record delimiters in received data
+ *  @details findByte() compares 32 bytes per instruction with AVX2 or 16 with SSE2, and falls back to a byte
+ *           at a time loop on other processors. The kernel is chosen once, at run time, from the features
+ *           of the processor.
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_SCAN_H
+#define TCP_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tcp {
+
+/** @brief   Identifies the implementation used by findByte() */
+enum class ScanKernel {SCALAR=0, SSE2, AVX2};
+
+/** @brief   Returns a pointer to the first occurrence of byte in [begin,end), or end if there is none */
+const uint8_t *findByte(const uint8_t *begin, const uint8_t *end, uint8_t byte);
+
+/** @brief   Returns the implementation that findByte() uses on this processor */
+ScanKernel scanKernel();
+
+/** @brief   Returns a pointer to the first occurrence of byte in [begin,end), or end, testing a byte at a time
+ *  @details The fallback used when no vector kernel is available */
+const uint8_t *findByteScalar(const uint8_t *begin, const uint8_t *end, uint8_t byte);
+
+} // namespace tcp
+
+#endif // include guard
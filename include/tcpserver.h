@@ -15,6 +15,7 @@
 #include <deque>
 #include <string.h>
 #include "tcpsocket.h"
+#include "tcpslotmap.h"
 #include "tcpssl.h"
 
 namespace tcp {
@@ -26,14 +27,46 @@ using namespace std;
 class Server;
 class Session;  
 
+/** @brief   Names a Session registered with a Server
+ *  @details A handle may be kept after its session has closed. Server.withSession() rejects it from 
+ *           then on, even if the session object has been reused by the session pool. */
+typedef SlotHandle SessionHandle;
+
+/** @brief   A SO_REUSEPORT listening socket owned by a Server 
+ *  @details In sharded mode the server opens one Listener per EPoll instance in its pool, all bound 
+ *           to the same address and port. The kernel load balances incoming connections across them
+ *           and each Listener hands its connections to sessions on its own EPoll instance, so no 
+ *           cross-thread handoff is required. Listeners are created and destroyed by the Server.
+ */
+class Listener : public Socket {
+  public:
+    Listener(EPoll &epoll, Server &server);
+
+    /** @brief   Starts listening for connections on an already bound socket */
+    bool listen(int backlog);
+  protected:
+    /** @brief   Calls Server::acceptConnections() when new connections are available */
+    void handleEvents(uint32_t events) override;
+
+    /** @brief   Starts a session for a connection accepted by an IO_URING EPoll instance */
+    void handleCompletion(IOOperation op, int result, bool more, const uint8_t *data) override;
+  private:
+    Server &server_;
+};
+
 /** @brief   Listens for TCP connections and establishes Sessions
  *  @details Construct an instance of tcp::server to start the server. Destroy the object to stop the server.
  *  @remark  A single server instance can listen to on an IP4 or IP6 address but not both.
  *  @remark  A single server instance can accept SSL connections, normal connections, but not both.
  *  @remark  Override the virtual createSession() method to return a custom session descendant class.
+ *  @remark  Call setThreads() before start() to distribute sessions over a pool of EPoll instances, 
+ *           each serviced by its own thread. The listening socket remains on the EPoll instance 
+ *           passed to the constructor unless setSharding() adds a listener to each thread.
  */
 class Server : public Socket {
   public:
+    static const size_t DEFAULT_ACCEPT_BATCH = 64; /**< Default value of acceptBatch() */
+
     /** @brief   Construct a server instance
      *  @param   domain   Either AF_INET or AF_INET6
      */
@@ -53,16 +86,95 @@ class Server : public Socket {
      *  @param   useSSL [in]  Set to true to use SSL on the connection
      *  @param   backlog [in]  How many connections can be stored in the listen backlog before the server stops 
      *                         accepting new connections.
+     *  @returns False if the server could not bind to the address, listen, or start every sharded listener.
+     *           The server socket is then closed, and any threads started for it are stopped.
      */
-    void start(in_port_t port, string bindaddress, bool useSSL = false, int backlog = 64);
+    bool start(in_port_t port, string bindaddress, bool useSSL = false, int backlog = 64);
     /** @brief   Start up the server 
      *  @details See the other overload for documentation
      */
-    void start(in_port_t port, char *bindaddress, bool useSSL = false, int backlog = 64);
+    bool start(in_port_t port, char *bindaddress, bool useSSL = false, int backlog = 64);
     
-    /** @brief   Stop the server */
+    /** @brief   Stop the server 
+     *  @details stop() runs the tasks posted to epoll(), which free the sessions it disconnects, and must
+     *           be called from the thread that polls it. */
     void stop();
 
+    /** @brief   Distribute sessions over a pool of EPoll instances
+     *  @details Creates an EPollPool with count threads. Each accepted session is registered with 
+     *           an EPoll instance from the pool chosen by selectEPoll() and all of its events are 
+     *           handled on that instance's thread. Must be called before start().
+     *  @param   count  [in]  The number of threads. If 0, one thread is created per hardware thread.
+     *  @param   policy [in]  How selectEPoll() chooses an EPoll instance for a new session
+     */
+    void setThreads(size_t count, BalancePolicy policy = BalancePolicy::ROUND_ROBIN);
+
+    /** @brief   Returns the EPoll pool used for sessions, or nullptr if setThreads() has not been called */
+    EPollPool *pool() { return pool_; }
+
+    /** @brief   Run Session.dataAvailable() on a pool of worker threads
+     *  @details Creates a WorkerPool with count threads that is passed to DataSocket.setWorkerPool() 
+     *           for each accepted session, so that a slow handler does not delay I/O for the other 
+     *           sessions on its EPoll instance. Must be called before start().
+     *  @param   count  [in]  The number of threads. If 0, one thread is created per hardware thread. */
+    void setWorkers(size_t count);
+
+    /** @brief   Returns the worker pool used for sessions, or nullptr if setWorkers() has not been called */
+    WorkerPool *workers() { return workers_; }
+
+    /** @brief   Enable one SO_REUSEPORT listening socket per thread
+     *  @details When enabled, start() opens a Listener for each EPoll instance in pool(), bound to the 
+     *           same address and port as the server. Connections accepted by a Listener are serviced by 
+     *           the same thread that accepted them. The server socket holds the port but does not listen,
+     *           so it accepts no connections itself. Requires setThreads(). 
+     *           Must be called before start().
+     *  @param   enabled    [in]  Set to true to enable sharded listeners
+     *  @param   steerByCPU [in]  If true, the pool threads are pinned to CPUs and a classic BPF program is 
+     *                            attached with SO_ATTACH_REUSEPORT_CBPF so that a connection is accepted by
+     *                            the Listener whose thread runs on the CPU that received it.
+     */
+    void setSharding(bool enabled, bool steerByCPU = false);
+
+    /** @brief   Sets the maximum number of connections accepted per listener event
+     *  @details Each EPOLLIN event on a listening socket accepts connections with accept4() until the 
+     *           backlog is empty or count connections have been accepted. Any remaining connections are 
+     *           accepted on the next poll(), after the events of other sockets have been handled. 0 means 
+     *           no limit. In edge triggered mode the backlog is always emptied, because no further event 
+     *           would be delivered for it. */
+    void setAcceptBatch(size_t count) { acceptBatch_ = count; }
+
+    /** @brief   Returns the maximum number of connections accepted per listener event */
+    size_t acceptBatch() const { return acceptBatch_; }
+
+    /** @brief   Keeps up to count closed sessions for reuse by later connections
+     *  @details A session whose connection has closed is returned to the pool of its EPoll instance 
+     *           instead of being deleted, and is reused for the next connection assigned to that instance 
+     *           instead of calling createSession(). Its buffers, which hold no memory once emptied, and its 
+     *           SSL object, which is cleared with SSL_clear(), are kept. Override Session.reset() to clear
+     *           the state of a descendant class. 0, the default, disables the pool. */
+    void setSessionPoolSize(size_t count);
+
+    /** @brief   Returns the maximum number of closed sessions kept for reuse */
+    size_t sessionPoolSize() const { return sessionPoolSize_; }
+
+    /** @brief   Returns the number of closed sessions currently kept for reuse */
+    size_t pooledSessions();
+
+    /** @brief   Calls fn with the session named by handle while holding the server and session mutexes
+     *  @details The session cannot be destroyed or disconnected by another thread while fn runs. fn must 
+     *           not disconnect it.
+     *  @returns False if the session has disconnected */
+    bool withSession(SessionHandle handle, const function<void(Session&)> &fn);
+
+    /** @brief   Calls withSession() with each session
+     *  @details The handles are collected first, with a linear scan of the contiguously stored sessions.
+     *           A session that disconnects before its turn is skipped. The same rules apply to fn as for 
+     *           withSession(). */
+    void forEachSession(const function<void(Session&)> &fn);
+
+    /** @brief   Returns the number of sessions */
+    size_t sessionCount();
+
     /** @brief   Determine if the server is listening
      *  @returns Returns true if the server is listening
      *  @returns Returns false if the server was not able to start listening. 
@@ -83,31 +195,63 @@ class Server : public Socket {
      *           accepted. This is handled by tcp::Server, which calls the acceptConnection method. 
      */
     void handleEvents(uint32_t events) override;
+
+    /** @brief   Called by an IO_URING EPoll instance when the multishot accept completes
+     *  @details Starts a session for the accepted socket handle and re-arms the accept if required. */
+    void handleCompletion(IOOperation op, int result, bool more, const uint8_t *data) override;
     
     /** @brief   Called when the server needs to create a new object of the tcp::Session class.
      *  @details Users of this component need to create their own custom tcp::Session class and use 
      *           this method to return an instance to it.
+     *  @param   epoll        The epoll instance to pass to the constructor of tcp::Session descendant
      *  @param   socket       The socket handle to pass to the constructor of tcp::Session descendant
      *  @param   peer_address The address and port of the connected peer 
      */
-    virtual Session* createSession(const int socket, const sockaddr_in peer_address) = 0;
+    virtual Session* createSession(EPoll &epoll, const int socket, const sockaddr_in peer_address) = 0;
+
+    /** @brief   Chooses the epoll instance that a newly accepted session will be registered with
+     *  @details The default implementation selects an instance from pool() using the policy passed to 
+     *           setThreads(), or returns epoll() if there is no pool. Override to provide a custom policy.
+     */
+    virtual EPoll &selectEPoll();
 
     /** @brief   Returns an interface address from an interface name and domain */
     bool findifaddr(const string ifname, sockaddr *addr);
 
-    /** @brief   Maps socket handles to their corresponding tcp::Session objects
-     *  @details Descendant classes may need access to the sessions map. 
+    /** @brief   Registers the sessions of the server by SessionHandle
+     *  @details Descendant classes may need access to the sessions. Hold mtx while using it.
      */
-    std::map<int,tcp::Session*> sessions;
+    SlotMap<tcp::Session*> sessions;
 
   private:
     bool bindToAddress(sockaddr *addr, socklen_t len);
     bool startListening(int backlog);
-    bool acceptConnection();
+    bool startListeners(int backlog);
+    void stopListeners();
+    bool attachCPUSteering();
+    void acceptConnections(int listener, EPoll *target);
+    bool acceptConnection(int listener, EPoll *target);
+    void completeAccept(int result, EPoll *target);
+    void startSession(int conn_sock, const sockaddr_in &peer_addr, EPoll &epoll);
+    bool recycle(Session *session);
+    Session *reuse(EPoll &epoll);
+    void trimSessionPool(size_t count);
     bool useSSL_ {false};
     SSLContext *ctx_;
+    EPollPool *pool_ {nullptr};
+    WorkerPool *workers_ {nullptr};
+    BalancePolicy policy_ {BalancePolicy::ROUND_ROBIN};
+    bool sharded_ {false};
+    bool steerByCPU_ {false};
+    size_t acceptBatch_ {DEFAULT_ACCEPT_BATCH};
+    size_t sessionPoolSize_ {0};
+    size_t pooled_ {0};
+    std::map<EPoll*,vector<Session*>> sessionPool_;  /**< Closed sessions kept for reuse, by EPoll instance */
+    vector<Session*> lingering_;  /**< Destroyed sessions waiting for their zerocopy sends to complete */
+    vector<Listener*> listeners_;
     struct sockaddr_storage addr_;
     friend class Session;
+    friend class Listener;
 };
 
 /** @brief   Represents a TCP connection accepted by the Server 
@@ -126,6 +270,9 @@ class Session : public DataSocket {
     /** @brief  Returns the peer address used to connect to this Session */
     in_addr_t peer_address() const { return addr_;   }
     
+    /** @brief  Returns the handle that names this session in Server.sessions */
+    SessionHandle handle() const { return handle_; }
+
     /** @brief  Returns true if the session is connected to a peer */
     bool connected() const { return state_ == SocketState::CONNECTED; }
 
@@ -143,19 +290,31 @@ class Session : public DataSocket {
      *  @details The constructor is protected and is called by the Server::createSession() method 
      */
     Session(EPoll &epoll, Server& server, const int socket, const struct sockaddr_in peer_addr) 
-      : DataSocket(epoll,server.domain(),socket), server_(server), port_(peer_addr.sin_port), addr_(peer_addr.sin_addr.s_addr) { }
+      : DataSocket(epoll,server.domain(),socket,false,EPOLLIN | EPOLLRDHUP,true), server_(server), port_(peer_addr.sin_port), addr_(peer_addr.sin_addr.s_addr) { }
     
     /** @brief The destructor is protected and is called by the disconnect() or disconnected() methods */
     virtual ~Session();
 
     /** @brief   Called by the Server::acceptConnection after a connection has been accepted
      *  @details Override accepted to perform operations when a session is first established.
-     *           In the base class, accepted() prints a message to clog.
+     *           In the base class, accepted() prints a message to clog, marks the session connected and
+     *           registers it for epoll events. Call it before anything that relies on events.
      */
     virtual void accepted();
     
+    /** @brief   Called when a pooled session is reused for a new connection, before accepted()
+     *  @details Override to return the state of a descendant class to how its constructor left it. The 
+     *           base class state has already been reset. See Server.setSessionPoolSize(). */
+    virtual void reset() {}
+
+    /** @brief   Returns the session to the session pool of the server, or deletes it if the pool is full */
+    void dispose() override;
+
+    /** @brief   Records the session with the server, so that Server::stop() can close it */
+    void lingerStarted() override;
+
     /** @brief   Called when a tcp connection is dropped 
-     *  @details Shuts down the network socket, removes itself from Server.sessions[], then destroys itself.
+     *  @details Shuts down the network socket, removes itself from Server.sessions, then destroys itself.
      *  @details An application can override disconnected() to perform additional cleanup operations 
      *           before the underlying TCP connection gets torn down. 
      *  @remark  To intentionally close a Session, call disconnect() instead
@@ -166,9 +325,11 @@ class Session : public DataSocket {
     friend class SSL;
   private:
     void connectionMessage(string action);
+    void reopen(const int socket, const struct sockaddr_in &peer_addr);
     Server& server_;
     in_port_t port_;
     in_addr_t addr_;
+    SessionHandle handle_;
     friend class Server;
 };
 
@@ -0,0 +1,150 @@
+/** @file    tcpslotmap.h
+ *  @brief   A dense container addressed by generation counted handles
+ *  @details Values are stored contiguously so that iterating over them is a linear scan. A handle names
+ *           a slot and the generation of the value it held when the handle was issued. Erasing a value
+ *           advances the generation of its slot, so an old handle is detected and rejected even after
+ *           the slot has been reused. Insertion, lookup and erasure take constant time.
+ *  @remarks Used by Server to register its sessions. See SessionHandle.
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_SLOTMAP_H
+#define TCP_SLOTMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace tcp {
+
+using namespace std;
+
+/** @brief   Names a value in a SlotMap
+ *  @details A default constructed handle is null and never refers to a value */
+struct SlotHandle {
+  uint32_t index {0};       /**< The slot that held the value */
+  uint32_t generation {0};  /**< The generation of the slot when the value was inserted. 0 means null. */
+
+  /** @brief Returns true if the handle is not null. It may still refer to a value that has been erased. */
+  explicit operator bool() const { return generation != 0; }
+
+  bool operator==(const SlotHandle &other) const { return (index == other.index) && (generation == other.generation); }
+  bool operator!=(const SlotHandle &other) const { return !(*this == other); }
+};
+
+/** @brief   Stores values contiguously and addresses them by SlotHandle
+ *  @details Erasing a value moves the last value into its place, so the order of iteration is not
+ *           stable and pointers to values are invalidated by insert() and erase(). Handles stay valid
+ *           until their value is erased. Not thread safe. */
+template<typename T>
+class SlotMap {
+  public:
+    typedef typename vector<T>::iterator iterator;
+    typedef typename vector<T>::const_iterator const_iterator;
+
+    /** @brief   Adds value and returns its handle */
+    SlotHandle insert(T value)
+    {
+      uint32_t index;
+      if (free_ != NONE) {
+        index = free_;
+        free_ = slots_[index].position;
+      } else {
+        index = (uint32_t)slots_.size();
+        slots_.push_back(Slot());
+      }
+      Slot &slot = slots_[index];
+      slot.position = (uint32_t)values_.size();
+      values_.push_back(std::move(value));
+      owners_.push_back(index);
+      SlotHandle result;
+      result.index = index;
+      result.generation = slot.generation;
+      return result;
+    }
+
+    /** @brief   Removes the value named by handle
+     *  @returns False if handle does not refer to a value */
+    bool erase(SlotHandle handle)
+    {
+      if (!contains(handle)) {
+        return false;
+      }
+      Slot &slot = slots_[handle.index];
+      uint32_t last = (uint32_t)values_.size() - 1;
+      if (slot.position != last) {
+        values_[slot.position] = std::move(values_[last]);
+        owners_[slot.position] = owners_[last];
+        slots_[owners_[last]].position = slot.position;
+      }
+      values_.pop_back();
+      owners_.pop_back();
+      // Generation 0 is reserved for null handles
+      if (++slot.generation == 0) {
+        slot.generation = 1;
+      }
+      slot.position = free_;
+      free_ = handle.index;
+      return true;
+    }
+
+    /** @brief   Returns true if handle refers to a value */
+    bool contains(SlotHandle handle) const
+    {
+      return (handle.generation != 0) && (handle.index < slots_.size()) && (slots_[handle.index].generation == handle.generation);
+    }
+
+    /** @brief   Returns a pointer to the value named by handle, or nullptr if it has been erased */
+    T *find(SlotHandle handle) { return contains(handle) ? &values_[slots_[handle.index].position] : nullptr; }
+
+    /** @brief   Returns a pointer to the value named by handle, or nullptr if it has been erased */
+    const T *find(SlotHandle handle) const { return contains(handle) ? &values_[slots_[handle.index].position] : nullptr; }
+
+    /** @brief   Allocates storage for count values so that inserting them does not allocate */
+    void reserve(size_t count)
+    {
+      values_.reserve(count);
+      owners_.reserve(count);
+      slots_.reserve(count);
+    }
+
+    /** @brief   Removes every value. Handles issued before the call are rejected afterwards. */
+    void clear()
+    {
+      while (!values_.empty()) {
+        SlotHandle handle;
+        handle.index = owners_.back();
+        handle.generation = slots_[handle.index].generation;
+        erase(handle);
+      }
+    }
+
+    /** @brief   Returns the number of values */
+    size_t size() const { return values_.size(); }
+
+    /** @brief   Returns true if there are no values */
+    bool empty() const { return values_.empty(); }
+
+    iterator begin() { return values_.begin(); }
+    iterator end() { return values_.end(); }
+    const_iterator begin() const { return values_.begin(); }
+    const_iterator end() const { return values_.end(); }
+  private:
+    static const uint32_t NONE = UINT32_MAX;
+    struct Slot {
+      uint32_t generation {1};
+      uint32_t position {0};  /**< Index in values_, or the next free slot */
+    };
+    vector<T> values_;          /**< The values, stored contiguously */
+    vector<uint32_t> owners_;   /**< The slot of each value */
+    vector<Slot> slots_;
+    uint32_t free_ {NONE};      /**< The first free slot */
+};
+
+} // namespace tcp
+
+#endif // include guard
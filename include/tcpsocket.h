@@ -17,11 +17,18 @@
 #include <deque>
 #include <map>
 #include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <arpa/inet.h>
 #include <sys/epoll.h>
 #include "tcpssl.h"
+#include "tcptimer.h"
+#include "tcptask.h"
+#include "tcpworker.h"
+#include "tcpbuffer.h"
 
 /** @brief A tcp client/server library for linux that supports openSSL and EPoll */
 namespace tcp {
@@ -51,45 +58,218 @@ void log(string msg);
 void log(string label, string msg);
 
 class Socket;
+class DataSocket;
 class SSLContext;
+class Ring;
 
 /** @brief   Determines the state of a socket. 
  *  @details Not all states are valid for every socket type. */
 enum class SocketState {UNCONNECTED=0, LISTENING, CONNECTING, CONNECTED, DISCONNECTED};
 
+/** @brief   Determines the kernel interface used by an EPoll instance
+ *  @details EPOLL dispatches readiness events from epoll_wait(). IO_URING uses a completion based
+ *           io_uring: listening sockets use multishot accepts, plaintext connections use multishot 
+ *           receives into a ring of provided buffers and sends are queued and submitted in a batch
+ *           once per call to poll(). SSL connections and connecting clients fall back to one shot 
+ *           poll requests, which are dispatched to Socket.handleEvents() like epoll events. */
+enum class EPollBackend {EPOLL=0, IO_URING};
+
+/** @brief   Determines when DataSocket.write() sends the data it queues
+ *  @details ON_WRITABLE arms EPOLLOUT and sends when the event arrives, or straight after dataAvailable()
+ *           returns. WRITE_THROUGH sends on the calling thread and only waits for EPOLLOUT with what could
+ *           not be sent. END_OF_LOOP marks the socket dirty, and the EPoll instance sends the output of 
+ *           every dirty socket once at the end of poll(), so a socket written to many times in one pass
+ *           is flushed with a single sendmsg(). */
+enum class FlushPolicy {ON_WRITABLE=0, WRITE_THROUGH, END_OF_LOOP};
+
+/** @brief   Identifies the io_uring operation passed to Socket.handleCompletion() */
+enum class IOOperation {ACCEPT=0, RECV, SEND};
+
 /** @brief   Encapsulates the EPoll interface
  *  @details Applications need to provide an epoll object for each thread in the application
  *           that uses sockets. These threads then call `EPoll.poll(100)` at regular intervals 
  *           to check for and respond to network events. 
  *  
- *  @details Appropriate events are added/remove from the epoll event list when a tcp::Socket 
- *           is created/destroyed. See the protected tcp::Socket.setEvents() method if you need
- *           to change which events a socket listens to.
+ *  @details A tcp::Socket is added to the epoll event list by Socket.enableEvents() once it is fully
+ *           constructed and ready for events, and removed when it is destroyed. See the protected 
+ *           tcp::Socket.setEvents() method if you need to change which events a socket listens to.
  *
  *  @details When incoming events are recieved, they are automatically dispatched to the virtual
  *           Socket.handleEvents() method.
  */
 class EPoll {
   public:
-    /** @brief Constructor */
-    EPoll();
+    /** @brief Constructor 
+     *  @param backend       The kernel interface to use. If IO_URING is not available on this kernel, 
+     *                       a warning is logged and EPOLL is used instead. 
+     *  @param edgeTriggered If true, sockets are registered with EPOLLET. Data sockets register for 
+     *                       EPOLLIN and EPOLLOUT once, drain reads and writes until EAGAIN and track 
+     *                       writability themselves instead of modifying their events on every write.
+     *                       Ignored by the IO_URING backend. */
+    EPoll(EPollBackend backend = EPollBackend::EPOLL, bool edgeTriggered = false);
 
     /** @brief Destructor */
     ~EPoll();
     
     /** @brief Call poll() regularly to respond to network events 
-     *  @param timeout Number of ms to wait for an event. Can be zero. */
+     *  @param timeout Number of ms to wait for an event. Can be zero. A negative value waits 
+     *                 indefinitely. The wait is shortened if a timer expires sooner. */
     void poll(int timeout); 
+
+    /** @brief   Calls callback once, delay ms from now, on the thread that calls poll()
+     *  @details May be called from any thread, including from within a timer callback
+     *  @returns A handle that can be passed to cancelTimer() */
+    TimerId setTimeout(unsigned delay, TimerCallback callback);
+
+    /** @brief   Calls callback every interval ms on the thread that calls poll() until it is cancelled
+     *  @details If poll() falls behind, missed intervals are skipped rather than fired in a burst
+     *  @returns A handle that can be passed to cancelTimer() */
+    TimerId setInterval(unsigned interval, TimerCallback callback);
+
+    /** @brief   Cancels a timer created by setTimeout() or setInterval()
+     *  @returns False if the timer has already fired or been cancelled */
+    bool cancelTimer(TimerId id);
+
+    /** @brief   Runs callable on the thread that calls poll()
+     *  @details May be called from any thread. The polling thread is woken through an eventfd and 
+     *           runs the tasks posted since it last woke in a batch, in the order they were posted, 
+     *           at the end of poll(). callable may be move only. */
+    template<typename Callable>
+    void post(Callable &&callable) { enqueue(new CallableTask<typename decay<Callable>::type>(std::forward<Callable>(callable))); }
+
+    /** @brief Returns the number of sockets registered with this epoll instance */
+    size_t size() const { return count_; }
+
+    /** @brief Returns the kernel interface used by this instance */
+    EPollBackend backend() const { return backend_; }
+
+    /** @brief Returns true if sockets are registered with EPOLLET */
+    bool edgeTriggered() const { return edgeTriggered_; }
+
+    /** @brief   Returns the pool that the buffers of DataSockets registered with this instance allocate from
+     *  @details Blocks are taken from the pool without locking while poll() is running. Data written from 
+     *           other threads is buffered in blocks from the heap. Configure the pool before sockets are
+     *           added to the instance. */
+    BlockPool &pool() { return pool_; }
   private:
     static const int MAX_EVENTS = 10; /**< Maximum number of epoll events to handle per poll() call */
+    static const int MAX_TASKS = 1024; /**< Maximum number of posted tasks to run per poll() call */
     bool add(Socket& socket, int events);
     bool update(Socket& socket, int events);
     bool remove(Socket& socket);    
-    void handleEvents(uint32_t events, int fd);
-    int handle_;
+    void handleEvents(uint32_t events, uint64_t data);
+    void handleCompletions();
+    bool arm(Socket& socket, int events);
+    bool submit(Socket& socket, IOOperation op);
+    bool submitSend(Socket& socket, vector<uint8_t> &&buffer);
+    void submitted();
+    Socket *find(int fd, uint16_t tag);
+    static uint64_t userData(const Socket& socket, uint8_t op);
+    void startTimers();
+    TimerId addTimer(uint64_t delay, uint64_t interval, TimerCallback &&callback);
+    int waitTime(int timeout);
+    void runTimers();
+    void armTimerfd(uint64_t deadline);
+    void readTimerfd();
+    void readEventfd();
+    void startTasks();
+    void enqueue(Task *task);
+    void wake();
+    void runTasks();
+    void flushDirty();
+    bool inPoll() const { return pool_.owned(); }
+    void drainTasks();
+    int handle_ {-1};
+    int eventfd_ {-1};
+    TaskQueue tasks_;
+    atomic<bool> wakePending_ {false};  /**< True if the eventfd has been signalled since runTasks() last started. Only suppresses redundant writes. */
+    int timerfd_ {-1};
+    TimerWheel *timers_ {nullptr};
+    uint64_t deadline_ {TimerWheel::NEVER};  /**< The time the timerfd is armed for */
+    mutex timerMtx;
+    EPollBackend backend_;
+    bool edgeTriggered_;
+    Ring *ring_ {nullptr};
+    uint16_t tags_ {0};
     epoll_event events[MAX_EVENTS];
-    std::map<int,tcp::Socket*> sockets;
+    /** @brief   The registered sockets, indexed by socket handle
+     *  @details Each slot holds the address of a socket shifted left by 16 bits, ORed with the tag it was
+     *           given by add(). Events carry the socket handle and tag, so a stale event for a handle that
+     *           has since been reused by another socket does not match the slot. find() reads the table 
+     *           without locking. Slots are changed under mtx, and a full table is replaced by a larger 
+     *           copy. Replaced tables are kept until the instance is destroyed, because the polling thread
+     *           may still be reading them. */
+    struct SlotTable {
+      explicit SlotTable(size_t size) : slots(size) {}
+      vector<atomic<uint64_t>> slots;
+    };
+    void setSlot(size_t fd, Socket *socket);
+    void clearSlot(size_t fd, Socket *socket);
+    atomic<SlotTable*> slots_ {nullptr};
+    vector<unique_ptr<SlotTable>> tables_;  /**< Every table allocated, including replaced ones */
+    vector<DataSocket*> dirty_;  /**< Sockets to flush at the end of poll(). Only used by the polling thread. */
+    BlockPool pool_ {ByteBuffer::allocationSize()};
+    atomic<size_t> count_ {0};
+    mutex mtx;
     friend class Socket;
+    friend class DataSocket;
+    friend class Server;
+};
+
+/** @brief   Determines how an EPollPool chooses the EPoll instance for a new connection 
+ *  @details ROUND_ROBIN cycles through the pool. LEAST_CONNECTIONS picks the EPoll instance 
+ *           with the fewest registered sockets. */
+enum class BalancePolicy {ROUND_ROBIN=0, LEAST_CONNECTIONS};
+
+/** @brief   A pool of EPoll instances, each polled by its own thread
+ *  @details An EPollPool lets a server spread its sessions over several cores. Each EPoll instance
+ *           in the pool is serviced by a dedicated thread that calls `EPoll.poll()` in a loop, so 
+ *           all events for a socket registered with that instance are handled on that thread.
+ */
+class EPollPool {
+  public:
+    /** @brief Constructor 
+     *  @param count   The number of EPoll instances (and threads) to create. 
+     *                 If 0, one instance is created per hardware thread.
+     *  @param timeout The timeout in ms passed to each call to `EPoll.poll()`. May be -1, as stop() wakes each thread. 
+     *  @param backend The kernel interface used by each EPoll instance 
+     *  @param edgeTriggered If true, each EPoll instance registers sockets with EPOLLET */
+    EPollPool(size_t count = 0, int timeout = 100, EPollBackend backend = EPollBackend::EPOLL, bool edgeTriggered = false);
+
+    /** @brief Destructor. Stops the pool if it is running. */
+    ~EPollPool();
+
+    /** @brief Starts one polling thread per EPoll instance */
+    void start();
+
+    /** @brief   Stops and joins the polling threads 
+     *  @details Sockets stay registered with their EPoll instances and will resume 
+     *           receiving events if start() is called again */
+    void stop();
+
+    /** @brief Returns true if the polling threads are running */
+    bool running() const { return running_; }
+
+    /** @brief   If true, the thread for EPoll instance i is pinned to CPU i (modulo the number of CPUs)
+     *  @details Takes effect the next time start() is called */
+    void setAffinity(bool value) { affinity_ = value; }
+
+    /** @brief Returns the number of EPoll instances in the pool */
+    size_t size() const { return epolls_.size(); }
+
+    /** @brief Returns the EPoll instance at index */
+    EPoll &operator[](size_t index) { return *epolls_[index]; }
+
+    /** @brief Chooses an EPoll instance from the pool using the given policy */
+    EPoll &select(BalancePolicy policy);
+  private:
+    void run(size_t index);
+    vector<unique_ptr<EPoll>> epolls_;
+    vector<thread> threads_;
+    atomic<bool> running_ {false};
+    bool affinity_ {false};
+    atomic<size_t> next_ {0};
+    int timeout_;
 };
 
 /** @brief Encapsulates a socket handle that is capable of recieving epoll events */
@@ -100,16 +280,20 @@ class Socket {
      *  @param domain Either AF_INET or AF_INET6
      *  @param socket The socket handle to encapsulate. If 0 is provided, a socket handle will be automatically created.
      *  @param blocking If true, a blocking socket will be created. If false, a non-blocking socket will be created.
-     *  @param events A bit flag of the epoll events to register interest include
-     * 
+     *  @param events A bit flag of the epoll events to register interest in once enableEvents() is called
+     *  @param accepted If true, socket was returned by accept4() with SOCK_NONBLOCK and its flags are left unchanged
+     *
+     *  @remark The constructor does not register the socket with epoll, so that no event is dispatched to a
+     *          descendant class before it has been constructed. See enableEvents().
      *  @remark A client or server listener will typically call the constructor with socket=0 to start with a new socket.
      *  @remark A server session will create a Socket by providing the socket handle returned from an accept command.
+     *  @remark New socket handles are created with SOCK_CLOEXEC, and with SOCK_NONBLOCK unless blocking is true.
      */
-    Socket(EPoll &epoll, const int domain = AF_INET, const int socket = 0, const bool blocking = false, const int events = (EPOLLIN | EPOLLRDHUP));
+    Socket(EPoll &epoll, const int domain = AF_INET, const int socket = 0, const bool blocking = false, const int events = (EPOLLIN | EPOLLRDHUP), const bool accepted = false);
 
     /** @brief Closes and destroys the socket
      *  @remark An active socket should first be shut down using the disconnect() command  */
-    ~Socket();
+    virtual ~Socket();
   
     /** @brief Return the linux socket handle */
     int socket() const { return socket_; }
@@ -123,15 +307,49 @@ class Socket {
   protected:
 
     /** @brief Changes which epoll events the socket listens for.
-     *  Descendant classes may want to override this
+     *  Descendant classes may want to override this. Before enableEvents() the events are only recorded.
      *  @param events A bitmask of event flags. See the epoll documentation */
     bool setEvents(int events);
 
+    /** @brief   Registers the socket handle with the epoll instance for the events last set
+     *  @details Called once the socket is ready to handle events: by a listening socket after listen(), by
+     *           a Session once it has been accepted and by a Client once it is connecting or connected.
+     *           Does nothing if the socket is already registered.
+     *  @returns False if the socket handle could not be added to the epoll instance */
+    bool enableEvents();
+
     /** @brief   Called when the socket recieves an epoll event
      *  @details Descendant classes override this abstract method to respond to epoll events
      *  @param   events   A bitmask of event flags. See the epoll documentation */
     virtual void handleEvents(uint32_t events) = 0;
 
+    /** @brief   Called when an io_uring operation submitted for this socket completes
+     *  @details Only called by an EPoll instance using the IO_URING backend. The default 
+     *           implementation does nothing.
+     *  @param   op     The operation that completed
+     *  @param   result A byte count, an accepted socket handle, or a negative errno value
+     *  @param   more   True if a multishot operation remains armed and will complete again
+     *  @param   data   The received bytes for a RECV completion, nullptr otherwise */
+    virtual void handleCompletion(IOOperation op, int result, bool more, const uint8_t *data);
+
+    /** @brief   Submits a multishot ACCEPT or RECV operation to an IO_URING EPoll instance
+     *  @returns False if the operation could not be queued */
+    bool submit(IOOperation op);
+
+    /** @brief   Submits a SEND of buffer to an IO_URING EPoll instance
+     *  @details The epoll instance owns buffer until the send completes. Partial sends are 
+     *           resubmitted automatically. handleCompletion() is called once all of buffer has
+     *           been sent or an error occurs.
+     *  @returns False if the operation could not be queued */
+    bool submitSend(vector<uint8_t> &&buffer);
+
+    /** @brief   Removes the socket handle from the epoll instance and closes it without destroying the object */
+    void closeHandle();
+
+    /** @brief   Takes a new socket handle, such as one returned by accept4() with SOCK_NONBLOCK, after closeHandle()
+     *  @details The handle is registered for events by the next call to enableEvents() */
+    void attach(int socket, int events);
+
     /** @brief   Called when a connection is disconnected due to a network error
      *  @details Sets the socket state to DISCONNECTED and frees its resources. 
      *           Override disconnected to perform additional cleanup of a dropped socket connection. */
@@ -144,22 +362,36 @@ class Socket {
     EPoll &epoll() { return epoll_; }
 
     /** @brief   Descendant classes can manipulate the socket state directly */
-    SocketState state_;    
+    SocketState state_ {SocketState::UNCONNECTED};
 
   private:
     EPoll &epoll_;
     int events_;
     int domain_;
     int socket_;
+    uint16_t tag_ {0};
+    uint8_t pollSeq_ {0};
+    bool polling_ {false};
+    bool registered_ {false};  /**< True between EPoll.add() and EPoll.remove() */
     friend class EPoll;
 };
 
+/** @brief   Called when a file region queued with DataSocket.sendFile() has been sent
+ *  @details The parameter is true if the whole region was handed to the kernel, or false if the file 
+ *           could not be read or the socket was destroyed first */
+typedef function<void(bool)> SendFileCallback;
+
 /** @brief   Represents a buffered socket that can send and receive data using optional SSL encryption
  *  @details This class provides properties and methods common to both the Client and Session classes */
 class DataSocket : public Socket {
   public:
-    DataSocket(EPoll &epoll, const int domain = AF_INET, const int socket = 0, const bool blocking = false, const int events = (EPOLLIN | EPOLLRDHUP)) :
-      Socket(epoll,domain,socket,blocking,events) {}
+    DataSocket(EPoll &epoll, const int domain = AF_INET, const int socket = 0, const bool blocking = false, const int events = (EPOLLIN | EPOLLRDHUP), const bool accepted = false) :
+      Socket(epoll,domain,socket,blocking,epoll.edgeTriggered() ? (events | EPOLLOUT) : events,accepted), 
+      inputBuffer(ByteBuffer::DEFAULT_BLOCK_SIZE,&epoll.pool()), outputBuffer(ByteBuffer::DEFAULT_BLOCK_SIZE,&epoll.pool()) {}
+
+    /** @brief   Destructor
+     *  @details Calls the callback of any file region that has not been sent with false */
+    virtual ~DataSocket();
 
     /** @brief Returns the number of bytes available in the inputBuffer */
     size_t available() { return inputBuffer.size(); }
@@ -167,29 +399,181 @@ class DataSocket : public Socket {
     /** @brief   Reads up to size bytes from inputBuffer into buffer
      *  @returns The number of bytes actually read */
     size_t read(void *buffer, size_t size);
+
+    /** @brief   Copies up to size bytes, starting offset bytes into the inputBuffer, into buffer
+     *  @details The data is not removed from the inputBuffer
+     *  @returns The number of bytes actually copied */
+    size_t peek(void *buffer, size_t size, size_t offset = 0);
+
+    /** @brief   Returns the position of the first occurrence of byte in the inputBuffer at or after offset
+     *  @details Remember how far a partial record has been searched and pass it as offset on the next read 
+     *           event so that no byte is searched twice. See DelimitedSession.
+     *  @returns The offset of the byte from the front of the inputBuffer, or ByteBuffer::NOT_FOUND */
+    size_t find(uint8_t byte, size_t offset = 0);
+
+    /** @brief   Returns a pointer to the first size bytes of the inputBuffer without copying them
+     *  @details Received data is stored in blocks, so a message that arrived in one read is usually 
+     *           contiguous. Hold mtx from this call until the data has been used, then call consume(). 
+     *           In dataAvailable() mtx only needs to be taken explicitly when a WorkerPool is set.
+     *  @returns nullptr if fewer than size bytes are available, or if they are split across blocks.
+     *           Use view(iov,count) or peek() in that case. */
+    const uint8_t *view(size_t size);
+
+    /** @brief   Describes up to limit bytes at the front of the inputBuffer as iovecs without copying them
+     *  @details The same locking rules apply as for view(size)
+     *  @returns The number of entries of iov used */
+    size_t view(struct iovec *iov, size_t count, size_t limit = SIZE_MAX);
+
+    /** @brief   Removes up to size bytes from the front of the inputBuffer
+     *  @returns The number of bytes removed */
+    size_t consume(size_t size);
     
     /** @brief   Writes the contents of buffer to the outputBuffer
      *  @details The content of the outputBuffer will be sent automatically at the next EPoll event */
     size_t write(const void *buffer, size_t size);
 
+    /** @brief   Queues a reference to the contents of buffer on the outputBuffer
+     *  @details The data is sent straight from the shared memory and the reference is released once it 
+     *           has all been sent, so writing one SharedBuffer to many sockets holds a single copy of the 
+     *           data. Small buffers are copied. On an IO_URING EPoll instance the data is copied when 
+     *           the send is submitted.
+     *  @returns The number of bytes queued */
+    size_t write(const SharedBuffer &buffer);
+
+    /** @brief   Queues size bytes of the file fd, starting at offset, to be sent after the data already written
+     *  @details Data written afterwards is sent after the file region. A plaintext socket transmits the
+     *           region with sendfile() as the socket becomes writable, so the file data never enters user
+     *           space. SSL connections and sockets on an IO_URING EPoll instance read the file in chunks
+     *           instead. fd must remain open and the region must not be modified until callback is called.
+     *  @param   fd       [in]  A file handle that supports pread() and sendfile()
+     *  @param   offset   [in]  The offset of the region in the file
+     *  @param   size     [in]  The number of bytes to send
+     *  @param   callback [in]  Called once the region has been sent. May be empty. 
+     *  @returns False if size is 0 or the socket is not connected */
+    bool sendFile(int fd, off_t offset, size_t size, SendFileCallback callback = SendFileCallback());
+
+    /** @brief   Determines when write() sends the data it queues. See FlushPolicy.
+     *  @details WRITE_THROUGH sends on the calling thread, unless the socket has returned EAGAIN since its 
+     *           last EPOLLOUT event. That saves an epoll_ctl() and a trip round the event loop per response,
+     *           at the cost of a send per write(). Edge triggered sockets always behave this way under 
+     *           ON_WRITABLE. END_OF_LOOP trades a delay of at most one poll() pass for far fewer system 
+     *           calls under pipelined load. Data written to an END_OF_LOOP socket from a thread other than
+     *           the one polling it is flushed by a task posted to the EPoll instance. The policy is ignored
+     *           while a WorkerPool is set, and an IO_URING EPoll instance already batches its sends. */
+    void setFlushPolicy(FlushPolicy policy) { flushPolicy_ = policy; }
+
+    /** @brief   Defers sending until the matching call to uncork()
+     *  @details Data written while the socket is corked is collected in the outputBuffer and sent as one 
+     *           batch by the last uncork(), so a header and body written separately leave in as few 
+     *           packets and system calls as possible. Data that is sent while corked, because it was 
+     *           already waiting for EPOLLOUT, is sent with MSG_MORE. Calls may be nested. */
+    void cork();
+
+    /** @brief   Ends a cork() and sends the batch if no other cork() is active
+     *  @details If the batch has already been sent with MSG_MORE, the last uncork() pushes out any partial
+     *           segment that the kernel is holding back. */
+    void uncork();
+
+    /** @brief   Corks a DataSocket for the lifetime of the object
+     *  @details Write a logical message inside the scope of a Batch to send it in one go */
+    class Batch {
+      public:
+        Batch(DataSocket &socket) : socket_(socket) { socket_.cork(); }
+        ~Batch() { socket_.uncork(); }
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+      private:
+        DataSocket &socket_;
+    };
+
+    /** @brief   Returns the number of bytes waiting to be sent, including queued file regions */
+    size_t bufferedAmount();
+
+    /** @brief   Sets the output watermarks used for backpressure
+     *  @details onWriteBlocked() is called when bufferedAmount() rises above high. onWriteDrained() is 
+     *           called when it then falls to low or below. Writes are never refused, so a writer that 
+     *           ignores onWriteBlocked() can still grow the outputBuffer without bound.
+     *  @param   high [in]  The high watermark in bytes, or 0 to disable the watermarks
+     *  @param   low  [in]  The low watermark in bytes. Clipped to high. */
+    void setWatermarks(size_t high, size_t low);
+
+    /** @brief   Returns true if bufferedAmount() has risen above the high watermark and not yet drained */
+    bool writeBlocked() const { return writeBlocked_; }
+
+    /** @brief   If true, the socket stops reading while its own output is blocked
+     *  @details Suits request/response protocols, where a peer that does not read its responses should 
+     *           not be able to keep sending requests. */
+    void setPauseOnWriteBlocked(bool value) { pauseOnWriteBlocked_ = value; }
+
+    /** @brief   Stops or resumes reading from the socket
+     *  @details While reading is paused the socket does not watch EPOLLIN, so unread data backs up into 
+     *           the kernel receive buffer and TCP flow control slows the peer down. A proxy calls this on 
+     *           its source socket from the onWriteBlocked() and onWriteDrained() callbacks of the sink. 
+     *           May be called from any thread. The change is applied by a task posted to the EPoll 
+     *           instance, so the mutex of this socket is not taken. Not supported on an IO_URING EPoll 
+     *           instance. */
+    void pauseReading(bool paused);
+
+    /** @brief   Returns true if reading has been paused */
+    bool readingPaused() const { return readPaused_; }
+
+    /** @brief   Runs dataAvailable() on a WorkerPool instead of the EPoll thread
+     *  @details The EPoll thread reads into the inputBuffer and queues the socket on the pool. 
+     *           dataAvailable() never runs on two workers at once for the same socket and is called 
+     *           without holding the socket mutex. Data written while a pool is set is sent by the 
+     *           EPoll thread. Must be called before the socket is connected. */
+    void setWorkerPool(WorkerPool *pool) { workers_ = pool; }
+
+    /** @brief   Sends with MSG_ZEROCOPY when at least threshold bytes are waiting in the outputBuffer
+     *  @details Enables SO_ZEROCOPY on the socket. The kernel transmits straight from the blocks of the 
+     *           outputBuffer, which are held until the completion notification is read from the socket
+     *           error queue. A destroyed socket is not freed until its pending sends have completed. 
+     *           Write a SharedBuffer to avoid the copy into the outputBuffer as well. 
+     *           Zerocopy costs page pinning and a notification per send, so it only pays off for large 
+     *           sends. It is not used for SSL connections or on an IO_URING EPoll instance. 
+     *  @param   threshold The smallest send that uses MSG_ZEROCOPY, or 0 to disable it
+     *  @returns False if the kernel does not support SO_ZEROCOPY */
+    bool setZeroCopy(size_t threshold);
+
+    /** @brief   Returns the number of zerocopy sends whose completion has not been received yet */
+    size_t zeroCopyPending() { return outputBuffer.pinned(); }
+
+    /** @brief   Returns the number of zerocopy sends that the kernel reported it had to copy anyway
+     *  @details The kernel copies when the route does not support zerocopy, as on the loopback interface */
+    size_t zeroCopyCopied() const { return zeroCopyCopied_; }
+
   protected:
 
-    /** @brief Reads all available data from the socket into inputBuffer */
+    /** @brief   Reads all available data from the socket into inputBuffer
+     *  @details Data is read with readv() straight into free space at the end of the inputBuffer. 
+     *           The size of each read adapts to the amount of data recently received. */
     void readToInputBuffer();
 
     /** @brief   Writes all available data from the outputBuffer to the socket 
-     *  @details Any data that could not be written will be retained in the outputBuffer and sent 
-     *           with the next call to sendOutputBuffer() */
+     *  @details The blocks of the outputBuffer are passed to sendmsg() directly, up to IOV_MAX at a time.
+     *           Any data that could not be written will be retained in the outputBuffer and sent 
+     *           with the next call to sendOutputBuffer(). See setZeroCopy(). File regions queued with 
+     *           sendFile() are sent when the data written before them has been sent. */
     void sendOutputBuffer();
 
     /** @brief   Sets the epoll event flags
-     *  @details The flags will include EPOLLOUT if value==true */
+     *  @details The flags will include EPOLLOUT if value==true 
+     *  @details On an edge triggered EPoll instance EPOLLOUT is always registered. If value==true
+     *           and the socket has not returned EAGAIN since the last EPOLLOUT event, the 
+     *           outputBuffer is sent immediately instead. */
     void canSend(bool value);
 
     /** @brief   Called by the EPoll class when the listening socket recieves an epoll event
      *  @details Calls either disconnected(), readToInputBuffer() + dataAvailable() or sendOutputBuffer()
-     *           depending on the events that have been set. */        
+     *           depending on the events that have been set. EPOLLERR reads zerocopy completions. 
+     *  @details On an IO_URING EPoll instance, the first event received by a connected plaintext socket 
+     *           switches it to multishot receives and queued sends. */        
     void handleEvents(uint32_t events) override;
+
+    /** @brief   Called by an IO_URING EPoll instance when a receive or send completes
+     *  @details Received data is appended to the inputBuffer and dataAvailable() is called. 
+     *           When a send completes, any data written since it was submitted is sent. */
+    void handleCompletion(IOOperation op, int result, bool more, const uint8_t *data) override;
     
     /** @brief   Shuts down any SSL connection gracefully
      *  @details Socket::disconnect() is called to shutdown the underlying socket */
@@ -205,19 +589,119 @@ class DataSocket : public Socket {
      *            response to received data */
     virtual void dataAvailable() = 0;
 
+    /** @brief    Called when bufferedAmount() rises above the high watermark
+     *  @details  Called with mtx held on the thread that wrote the data. Do not lock another socket 
+     *            here, because that socket may be writing to this one. pauseReading() is safe to call. 
+     *            See setWatermarks(). */
+    virtual void onWriteBlocked() {}
+
+    /** @brief    Called when bufferedAmount() falls to the low watermark after onWriteBlocked()
+     *  @details  Called with mtx held on the thread that sent the data. See onWriteBlocked(). */
+    virtual void onWriteDrained() {}
+
     /** @brief    Factory method for returning an SSL object.
      *  @details  Override to replace the SSL class used. */
     virtual SSL *createSSL(SSLContext *context);
 
+    /** @brief   Deletes a socket that was allocated with new
+     *  @details The socket is removed from its EPoll instance now. If dataAvailable() is queued or running
+     *           on a worker, or a send requested by a worker is pending, it is deleted when that work has
+     *           finished. The object is freed by calling dispose() on the thread that polls the EPoll 
+     *           instance, so that an event being dispatched to it there can complete. When destroy() is
+     *           called on any other thread, dispose() is run by a task posted to the instance. If zerocopy
+     *           sends are still pending, the socket handle is kept open and dispose() is called once the
+     *           kernel has reported that they are complete. */
+    void destroy();
+
+    /** @brief   Frees the socket once destroy() has been called and no work refers to it
+     *  @details The default implementation deletes the object. Session overrides it to return the 
+     *           object to the session pool of its Server. */
+    virtual void dispose();
+
+    /** @brief   Called when a destroyed socket starts waiting for its zerocopy sends to complete
+     *  @details dispose() is called once they have completed, or by stopLingering(). Session overrides 
+     *           this so that Server::stop() can close sessions that are still waiting. */
+    virtual void lingerStarted() {}
+
+    /** @brief   Stops waiting for the zerocopy sends of a destroyed socket and disposes of it
+     *  @details The connection is reset, so that data the kernel has not yet sent is discarded. Does 
+     *           nothing if the socket is not waiting. */
+    void stopLingering();
+
+    /** @brief   Closes the socket handle and returns the connection state to how the constructor left it
+     *  @details Settings such as the watermarks, flush policy and worker pool are kept. Queued data and 
+     *           file regions are discarded, and the SSL object is cleared with SSL_clear() so that it can 
+     *           be used for another connection. Called on a destroyed socket that is about to be reused. */
+    void recycle();
+
     /** @brief   Exposes the underlying SSL record used for openSSL calls to descendant classes */
     SSL *ssl_ {nullptr};
 
   private:    
-    size_t read_(void *buffer, size_t size);
-    size_t write_(const void *buffer, size_t size);
-    deque<uint8_t> inputBuffer;
-    deque<uint8_t> outputBuffer;
+    static const size_t MIN_READ_SIZE = 2048;    /**< Smallest amount of buffer space offered to a read */
+    static const size_t MAX_READ_SIZE = 262144;  /**< Largest amount of buffer space offered to a read */
+    static const size_t FILE_CHUNK_SIZE = 65536; /**< Amount of a file region read at a time when sendfile() cannot be used */
+    class Reference;
+    /** @brief A file region queued by sendFile() */
+    struct FileRegion {
+      int fd;
+      off_t offset;
+      size_t size;        /**< Bytes not sent yet */
+      uint64_t mark;      /**< The value of sent_ once the data written before the region has been sent */
+      SendFileCallback callback;
+    };
+    bool hasOutput() const { return !outputBuffer.empty() || !files_.empty(); }
+    size_t buffered() const;  /**< bufferedAmount() for a caller that holds mtx */
+    void checkWatermarks();
+    bool setCork(bool value);
+    void flushOutput();
+    void markDirty();
+    void flushDirty();
+    void updateReading();
+    size_t sendable() const;
+    bool sendFileRegion(vector<SendFileCallback> &completed);
+    size_t read_(const struct iovec *iov, size_t count);
+    size_t write_(const struct iovec *iov, size_t count, int flags = 0);
+    void readErrorQueue();
+    void startCompletions();
+    void queueSend();
+    void schedule();
+    void work();
+    void requestFlush();
+    void flush();
+    bool ref();
+    void unref();
+    void tryRelease();
+    void release();
+    void finish();
+    void linger();
+    WorkerPool *workers_ {nullptr};
+    atomic<unsigned> work_ {0};   /**< Notifications not yet handled by the worker */
+    atomic<unsigned> refs_ {0};   /**< Tasks that refer to this socket, plus flags set by destroy() and release() */
+    atomic<bool> flushPending_ {false};
+    size_t readSize_ {MIN_READ_SIZE * 2};
+    unsigned corked_ {0};
+    bool morePending_ {false};  /**< True if the last send was made with MSG_MORE */
+    FlushPolicy flushPolicy_ {FlushPolicy::ON_WRITABLE};
+    bool dirty_ {false};  /**< True if the socket is in the dirty list of its EPoll instance */
+    size_t highWatermark_ {0};
+    size_t lowWatermark_ {0};
+    bool writeBlocked_ {false};
+    bool pauseOnWriteBlocked_ {false};
+    atomic<bool> readPaused_ {false};
+    bool readPending_ {false};  /**< True if EPOLLIN was received while reading was paused */
+    size_t zeroCopyThreshold_ {0};
+    size_t zeroCopyCopied_ {0};
+    ByteBuffer inputBuffer;
+    ByteBuffer outputBuffer;
+    deque<FileRegion> files_;
+    uint64_t sent_ {0};   /**< Bytes taken from the outputBuffer for sending */
+    bool completion_ {false};
+    bool lingering_ {false};  /**< True while a destroyed socket waits for its zerocopy completions */
+    bool sending_ {false};
+    bool writable_ {true};
     friend class SSL;
+    friend class EPoll;
 };
 
 /** @brief   Tries to determine which address family to use from a host and port string
@@ -0,0 +1,80 @@
+/** @file    tcptask.h
+ *  @brief   Tasks posted to an EPoll instance from other threads
+ *  @details Tasks are passed between threads through a lock free, intrusive multiple producer
+ *           single consumer queue. Producers never block or allocate beyond the task itself.
+ *  @remarks Applications do not normally use these classes directly. Use EPoll.post().
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_TASK_H
+#define TCP_TASK_H
+
+#include <atomic>
+#include <utility>
+
+namespace tcp {
+
+using namespace std;
+
+/** @brief   A unit of work that is run once by the thread that polls an EPoll instance */
+class Task {
+  public:
+    /** @brief Destructor */
+    virtual ~Task() {}
+
+    /** @brief Override to perform the work */
+    virtual void run() = 0;
+  private:
+    atomic<Task*> next_ {nullptr};
+    friend class TaskQueue;
+};
+
+/** @brief   A task that calls a function object
+ *  @details The function object may be move only */
+template<typename Callable>
+class CallableTask : public Task {
+  public:
+    /** @brief Constructor */
+    CallableTask(Callable &&callable) : callable_(std::move(callable)) {}
+
+    /** @brief Constructor */
+    CallableTask(const Callable &callable) : callable_(callable) {}
+
+    /** @brief Calls the function object */
+    void run() override { callable_(); }
+  private:
+    Callable callable_;
+};
+
+/** @brief   An intrusive multiple producer, single consumer queue of tasks
+ *  @details push() may be called from any thread. pop() must only be called by the consumer. */
+class TaskQueue {
+  public:
+    /** @brief Constructor */
+    TaskQueue();
+
+    /** @brief Destructor. Deletes any tasks that were not popped. */
+    ~TaskQueue();
+
+    /** @brief Adds task to the back of the queue. The queue owns task until it is popped. */
+    void push(Task *task);
+
+    /** @brief   Removes the task at the front of the queue
+     *  @returns nullptr if the queue is empty, or if the next task is still being pushed */
+    Task *pop();
+  private:
+    class Stub : public Task {
+      public:
+        void run() override {}
+    };
+    atomic<Task*> head_;
+    Task *tail_;
+    Stub stub_;
+};
+
+} // namespace tcp
+
+#endif // include guard
@@ -0,0 +1,98 @@
+/** @file    tcptimer.h
+ *  @brief   A hierarchical timing wheel used by EPoll to schedule timers
+ *  @details Timers are kept in four levels of 256 slots with a resolution of 1ms. Adding and cancelling
+ *           a timer are O(1). Timers in the upper levels are cascaded down one level each time the level
+ *           below wraps around, so each timer is moved at most three times before it fires.
+ *  @remarks Applications do not use this class directly. Use EPoll.setTimeout() and EPoll.setInterval().
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_TIMER_H
+#define TCP_TIMER_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace tcp {
+
+using namespace std;
+
+/** @brief   Identifies a timer created by EPoll.setTimeout() or EPoll.setInterval()
+ *  @details Zero is never a valid timer id */
+typedef uint64_t TimerId;
+
+/** @brief   The function called when a timer expires */
+typedef function<void()> TimerCallback;
+
+/** @brief   A hierarchical timing wheel
+ *  @details Times are absolute and measured in ms. The wheel is not thread safe. */
+class TimerWheel {
+  public:
+    static const uint64_t NEVER = UINT64_MAX; /**< Returned by next() when the wheel is empty */
+
+    /** @brief   Constructor
+     *  @param   now  [in]  The current time */
+    TimerWheel(uint64_t now);
+
+    /** @brief   Adds a timer
+     *  @param   expiry   [in]  The time at which the timer first expires
+     *  @param   interval [in]  If non zero, the timer is re-added interval ms after each expiry
+     *  @param   callback [in]  The function to call when the timer expires
+     *  @returns A handle that can be passed to cancel() */
+    TimerId add(uint64_t expiry, uint64_t interval, TimerCallback callback);
+
+    /** @brief   Removes a timer
+     *  @returns False if the timer has already expired or been cancelled */
+    bool cancel(TimerId id);
+
+    /** @brief   Advances the wheel to now
+     *  @details The callback of each timer that expired is appended to expired. One shot timers
+     *           are removed. Periodic timers are re-added and fire at most once per call. */
+    void expire(uint64_t now, vector<shared_ptr<TimerCallback>> &expired);
+
+    /** @brief   Returns a time no later than the earliest expiry, or NEVER if the wheel is empty
+     *  @details Timers in the upper levels are reported at the time they cascade down a level */
+    uint64_t next() const;
+
+    /** @brief   Returns the number of timers in the wheel */
+    size_t size() const { return count_; }
+  private:
+    static const unsigned LEVELS = 4;
+    static const unsigned BITS = 8;
+    static const unsigned SLOTS = 1 << BITS;
+    static const uint64_t MASK = SLOTS - 1;
+    static const uint32_t NIL = UINT32_MAX;
+    struct Node {
+      uint64_t expiry {0};
+      uint64_t interval {0};
+      shared_ptr<TimerCallback> callback;
+      uint32_t prev {NIL};
+      uint32_t next {NIL};
+      uint32_t generation {0};
+      uint16_t slot {0};
+      bool active {false};
+    };
+    void place(uint32_t index);
+    void link(uint32_t index, unsigned level, unsigned slot);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    uint32_t detach(unsigned level, unsigned slot);
+    void cascade();
+    void advance(uint64_t tick);
+    int findSlot(unsigned level, unsigned from, unsigned to) const;
+    vector<Node> nodes_;
+    vector<uint32_t> free_;
+    uint32_t heads_[LEVELS][SLOTS];
+    uint64_t occupied_[LEVELS][SLOTS / 64];
+    uint64_t current_;  /**< The next tick to be processed */
+    size_t count_ {0};
+};
+
+} // namespace tcp
+
+#endif // include guard
@@ -0,0 +1,128 @@
+/** @file    tcpuring.h
+ *  @brief   A minimal io_uring interface used by the IO_URING EPoll backend
+ *  @details Wraps the io_uring_setup/io_uring_enter/io_uring_register system calls directly so that
+ *           liburing is not required. Submissions are queued and sent to the kernel in a single
+ *           io_uring_enter call per EPoll::poll() iteration.
+ *  @remarks Applications do not use this class directly. Construct an EPoll with EPollBackend::IO_URING.
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_URING_H
+#define TCP_URING_H
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <linux/io_uring.h>
+
+namespace tcp {
+
+using namespace std;
+
+/** @brief   Encapsulates an io_uring submission/completion queue pair and a provided buffer ring
+ *  @details Submission methods may be called from any thread. Queued requests are submitted by the next
+ *           call to wait(), so EPoll wakes its polling thread when a request is queued from another thread.
+ *           cancel() and a full submission queue submit immediately while holding the lock. The number
+ *           of requests to submit is taken from the head of the kernel, so these submissions cannot 
+ *           race the one made by wait(). Completions must only be consumed by the thread that calls wait().
+ */
+class Ring {
+  public:
+    /** @brief   Constructor
+     *  @param   entries    [in]  The number of submission queue entries
+     *  @param   buffers    [in]  The number of provided receive buffers. Must be a power of 2.
+     *  @param   bufferSize [in]  The size of each provided receive buffer */
+    Ring(unsigned entries = 256, unsigned buffers = 256, unsigned bufferSize = 16384);
+
+    /** @brief   Destructor */
+    ~Ring();
+
+    /** @brief   Returns true if the ring was set up successfully */
+    bool valid() const { return fd_ != -1; }
+
+    /** @brief   Queues a one shot poll for events on fd */
+    bool pollAdd(int fd, uint32_t events, uint64_t data);
+
+    /** @brief   Queues the removal of the poll request identified by target */
+    bool pollRemove(uint64_t target);
+
+    /** @brief   Queues a multishot accept on the listening socket fd */
+    bool accept(int fd, uint64_t data);
+
+    /** @brief   Queues a multishot receive on fd into the provided buffer ring */
+    bool recv(int fd, uint64_t data);
+
+    /** @brief   Queues a send of buffer on fd
+     *  @details The ring owns buffer until the send completes. Partial sends are resubmitted
+     *           automatically by sent(). */
+    bool send(int fd, vector<uint8_t> &&buffer, uint64_t data);
+
+    /** @brief   Cancels all requests for fd and submits the cancellation immediately */
+    bool cancel(int fd);
+
+    /** @brief   Called when a send completion arrives
+     *  @returns True if the send identified by data has finished, false if the unsent remainder
+     *           was resubmitted */
+    bool sent(uint64_t data, int result);
+
+    /** @brief   Submits all queued requests and waits for at least one completion
+     *  @param   timeout  [in]  Number of ms to wait. Can be zero. A negative value waits indefinitely. */
+    void wait(int timeout);
+
+    /** @brief   Copies the next completion into cqe
+     *  @returns False if the completion queue is empty */
+    bool peek(io_uring_cqe &cqe);
+
+    /** @brief   Removes the completion returned by peek() from the completion queue */
+    void advance();
+
+    /** @brief   Returns the provided buffer with the given buffer id */
+    uint8_t *buffer(uint16_t id) { return buffers_ + (size_t)id * bufferSize_; }
+
+    /** @brief   Returns a provided buffer to the kernel once its data has been consumed */
+    void recycle(uint16_t id);
+
+  private:
+    struct Send {
+      vector<uint8_t> buffer;
+      size_t offset;
+      int fd;
+    };
+    io_uring_sqe *getSQE();
+    void push();
+    unsigned queued() const;
+    void submit();
+    int enter(unsigned submit, unsigned complete, unsigned flags, void *arg);
+    bool prepareSend(int fd, const uint8_t *data, size_t size, uint64_t user_data);
+    int fd_ {-1};
+    mutex mtx;  /**< Held while requests are queued, and while they are submitted without waiting */
+    unsigned sqEntries_ {0};
+    unsigned sqTail_ {0};
+    unsigned *sqHead_ {nullptr};
+    unsigned *sqTailPtr_ {nullptr};
+    unsigned *sqMask_ {nullptr};
+    unsigned *sqArray_ {nullptr};
+    unsigned *cqHead_ {nullptr};
+    unsigned *cqTail_ {nullptr};
+    unsigned *cqMask_ {nullptr};
+    io_uring_sqe *sqes_ {nullptr};
+    io_uring_cqe *cqes_ {nullptr};
+    void *sqRing_ {nullptr};
+    void *cqRing_ {nullptr};
+    size_t sqRingSize_ {0};
+    size_t cqRingSize_ {0};
+    size_t sqesSize_ {0};
+    io_uring_buf_ring *bufRing_ {nullptr};
+    uint8_t *buffers_ {nullptr};
+    unsigned bufferCount_;
+    unsigned bufferSize_;
+    uint16_t bufTail_ {0};
+    std::map<uint64_t,Send> sends_;
+};
+
+} // namespace tcp
+
+#endif // include guard
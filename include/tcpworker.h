@@ -0,0 +1,77 @@
+/** @file    tcpworker.h
+ *  @brief   A work stealing thread pool used to run DataSocket.dataAvailable() off the I/O threads
+ *  @details Each worker thread has its own task deque. Tasks submitted from outside the pool are
+ *           distributed round robin. A worker takes tasks from the front of its own deque and, when
+ *           that is empty, steals from the back of the other workers' deques.
+ *  @author  Bond Keevil
+ *  @version 1.0
+ *  @date    2019
+ *  @copyright GPLv3.0
+ */
+
+#ifndef TCP_WORKER_H
+#define TCP_WORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "tcptask.h"
+
+namespace tcp {
+
+using namespace std;
+
+/** @brief   A work stealing pool of threads that run tasks
+ *  @details Pass a WorkerPool to DataSocket.setWorkerPool() or Server.setWorkers() to run dataAvailable()
+ *           on the pool while the EPoll thread only performs I/O. */
+class WorkerPool {
+  public:
+    /** @brief Constructor
+     *  @param count The number of worker threads. If 0, one thread is created per hardware thread. */
+    WorkerPool(size_t count = 0);
+
+    /** @brief Destructor. Stops the pool if it is running. */
+    ~WorkerPool();
+
+    /** @brief Starts the worker threads */
+    void start();
+
+    /** @brief   Stops and joins the worker threads
+     *  @details Tasks that have already been submitted are run before the threads exit */
+    void stop();
+
+    /** @brief Returns true if the worker threads are running */
+    bool running() const { return running_; }
+
+    /** @brief Returns the number of worker threads */
+    size_t size() const { return workers_.size(); }
+
+    /** @brief   Runs callable on one of the worker threads
+     *  @details May be called from any thread. A task submitted from a worker thread is queued on
+     *           that worker. callable may be move only. */
+    template<typename Callable>
+    void submit(Callable &&callable) { enqueue(new CallableTask<typename decay<Callable>::type>(std::forward<Callable>(callable))); }
+  private:
+    struct Worker {
+      mutex mtx;
+      deque<Task*> tasks;
+    };
+    void enqueue(Task *task);
+    Task *take(size_t index);
+    void run(size_t index);
+    vector<unique_ptr<Worker>> workers_;
+    vector<thread> threads_;
+    atomic<bool> running_ {false};
+    atomic<size_t> next_ {0};
+    atomic<long> pending_ {0};  /**< The number of queued tasks. Briefly negative while a task is being submitted. */
+    mutex mtx;
+    condition_variable idle_;
+};
+
+} // namespace tcp
+
+#endif // include guard
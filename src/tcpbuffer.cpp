@@ -0,0 +1,360 @@
+#include "tcpbuffer.h"
+#include "tcpscan.h"
+#include <algorithm>
+#include <new>
+#include <string.h>
+
+namespace tcp {
+
+using namespace std;
+
+SharedBuffer::SharedBuffer(const void *data, size_t size) : 
+  data_(make_shared<const vector<uint8_t>>(static_cast<const uint8_t*>(data),static_cast<const uint8_t*>(data) + size)), size_(size)
+{
+}
+
+SharedBuffer::SharedBuffer(vector<uint8_t> &&data) : size_(data.size())
+{
+  data_ = make_shared<const vector<uint8_t>>(std::move(data));
+}
+
+SharedBuffer SharedBuffer::slice(size_t offset, size_t size) const
+{
+  SharedBuffer result;
+  offset = min(offset,size_);
+  result.data_ = data_;
+  result.offset_ = offset_ + offset;
+  result.size_ = min(size,size_ - offset);
+  return result;
+}
+
+ByteBuffer::ByteBuffer(size_t blockSize, BlockPool *pool) : blockSize_(blockSize ? blockSize : DEFAULT_BLOCK_SIZE)
+{
+  pool_ = (pool && (pool->size() == allocationSize(blockSize_))) ? pool : nullptr;
+}
+
+ByteBuffer::~ByteBuffer()
+{
+  // Blocks that are still pinned may be read by the kernel after the buffer has gone, so they are left
+  // allocated instead of being reused. DataSocket waits for its zerocopy completions to avoid this.
+  clear();
+  while (spare_) {
+    Block *next = spare_->next;
+    destroy(spare_);
+    spare_ = next;
+  }
+}
+
+ByteBuffer::Block *ByteBuffer::create()
+{
+  Block *block = pool_ ? static_cast<Block*>(pool_->allocate()) : nullptr;
+  if (block) {
+    block->pool = pool_;
+  } else {
+    block = static_cast<Block*>(::operator new(allocationSize(blockSize_)));
+    block->pool = nullptr;
+  }
+  return block;
+}
+
+void ByteBuffer::destroy(Block *block)
+{
+  if (block->pool) {
+    block->pool->release(block);
+  } else {
+    ::operator delete(block);
+  }
+}
+
+ByteBuffer::Block *ByteBuffer::allocate()
+{
+  Block *block = spare_;
+  if (block) {
+    spare_ = block->next;
+    --spareCount_;
+  } else {
+    block = create();
+  }
+  block->next = nullptr;
+  block->base = block->data();
+  block->begin = 0;
+  block->end = 0;
+  block->pins = 0;
+  block->retired = false;
+  block->shared = false;
+  return block;
+}
+
+void ByteBuffer::release(Block *block)
+{
+  if (block->shared) {
+    reinterpret_cast<SharedBuffer*>(block->data())->~SharedBuffer();
+    ::operator delete(block);
+  } else if (pool_ || (spareCount_ > 0)) {
+    // The pool is as cheap as a spare block and lets other buffers use the memory
+    destroy(block);
+  } else {
+    block->next = spare_;
+    spare_ = block;
+    ++spareCount_;
+  }
+}
+
+void ByteBuffer::retire(Block *block)
+{
+  if (block->pins > 0) {
+    // unpin() releases the block
+    block->retired = true;
+  } else {
+    release(block);
+  }
+}
+
+void ByteBuffer::link(Block *block)
+{
+  if (tail_) {
+    tail_->next = block;
+  } else {
+    head_ = block;
+  }
+  tail_ = block;
+}
+
+void ByteBuffer::trim()
+{
+  while (spareCount_ > (pool_ ? 0U : 1U)) {
+    Block *next = spare_->next;
+    destroy(spare_);
+    spare_ = next;
+    --spareCount_;
+  }
+}
+
+void ByteBuffer::append(const void *data, size_t size)
+{
+  const uint8_t *src = static_cast<const uint8_t*>(data);
+  while (size > 0) {
+    if (!tail_ || (space(tail_) == 0)) {
+      link(allocate());
+    }
+    size_t count = min(size,space(tail_));
+    memcpy(tail_->base + tail_->end,src,count);
+    tail_->end += count;
+    size_ += count;
+    src += count;
+    size -= count;
+  }
+}
+
+void ByteBuffer::append(const SharedBuffer &buffer)
+{
+  if (buffer.size() <= SHARED_COPY_SIZE) {
+    append(buffer.data(),buffer.size());
+    return;
+  }
+  Block *block = static_cast<Block*>(::operator new(sizeof(Block) + sizeof(SharedBuffer)));
+  SharedBuffer *shared = new (block->data()) SharedBuffer(buffer);
+  block->next = nullptr;
+  block->base = const_cast<uint8_t*>(shared->data());
+  block->begin = 0;
+  block->end = shared->size();
+  block->pool = nullptr;
+  block->pins = 0;
+  block->retired = false;
+  block->shared = true;
+  link(block);
+  size_ += block->end;
+}
+
+const uint8_t *ByteBuffer::contiguous(size_t size) const
+{
+  if (head_ && (head_->end - head_->begin >= size)) {
+    return head_->base + head_->begin;
+  } else {
+    return nullptr;
+  }
+}
+
+size_t ByteBuffer::peek(void *data, size_t size, size_t offset) const
+{
+  uint8_t *dst = static_cast<uint8_t*>(data);
+  size_t result = 0;
+  for (Block *block = head_;block && (result < size);block = block->next) {
+    size_t length = block->end - block->begin;
+    if (offset >= length) {
+      offset -= length;
+      continue;
+    }
+    size_t count = min(size - result,length - offset);
+    memcpy(dst + result,block->base + block->begin + offset,count);
+    result += count;
+    offset = 0;
+  }
+  return result;
+}
+
+size_t ByteBuffer::find(uint8_t byte, size_t offset) const
+{
+  size_t position = 0;
+  for (Block *block = head_;block;block = block->next) {
+    size_t length = block->end - block->begin;
+    if (offset >= length) {
+      offset -= length;
+      position += length;
+      continue;
+    }
+    const uint8_t *begin = block->base + block->begin;
+    const uint8_t *found = findByte(begin + offset,begin + length,byte);
+    if (found < begin + length) {
+      return position + (found - begin);
+    }
+    position += length;
+    offset = 0;
+  }
+  return NOT_FOUND;
+}
+
+size_t ByteBuffer::read(void *data, size_t size)
+{
+  return consume(peek(data,size));
+}
+
+size_t ByteBuffer::consume(size_t size)
+{
+  size_t result = 0;
+  while (head_ && (result < size)) {
+    size_t count = min(size - result,head_->end - head_->begin);
+    head_->begin += count;
+    result += count;
+    if (head_->begin == head_->end) {
+      if ((head_ == tail_) && !head_->shared && (head_->pins == 0)) {
+        // Reuse the last block from the start rather than freeing it
+        head_->begin = 0;
+        head_->end = 0;
+        break;
+      }
+      Block *next = head_->next;
+      retire(head_);
+      head_ = next;
+      if (!head_) {
+        tail_ = nullptr;
+      }
+    }
+  }
+  size_ -= result;
+  return result;
+}
+
+void ByteBuffer::clear()
+{
+  while (head_) {
+    Block *next = head_->next;
+    retire(head_);
+    head_ = next;
+  }
+  tail_ = nullptr;
+  size_ = 0;
+  if (pins_.empty()) {
+    // A new socket numbers its zerocopy sends from 0
+    nextPin_ = 0;
+  }
+}
+
+size_t ByteBuffer::reserve(size_t size, struct iovec *iov, size_t count)
+{
+  size_t result = 0;
+  size_t available = 0;
+  if (tail_ && (space(tail_) > 0) && (count > 0)) {
+    iov[0].iov_base = tail_->base + tail_->end;
+    iov[0].iov_len = space(tail_);
+    available = iov[0].iov_len;
+    result = 1;
+  }
+  // The rest of the space comes from the spare blocks, which commit() links in order
+  Block **next = &spare_;
+  while ((available < size) && (result < count)) {
+    if (*next == nullptr) {
+      *next = create();
+      (*next)->next = nullptr;
+      ++spareCount_;
+    }
+    iov[result].iov_base = (*next)->data();
+    iov[result].iov_len = blockSize_;
+    available += blockSize_;
+    ++result;
+    next = &(*next)->next;
+  }
+  return result;
+}
+
+void ByteBuffer::commit(size_t size)
+{
+  if (tail_ && (space(tail_) > 0)) {
+    size_t count = min(size,space(tail_));
+    tail_->end += count;
+    size_ += count;
+    size -= count;
+  }
+  while (size > 0) {
+    Block *block = allocate();
+    block->end = min(size,blockSize_);
+    link(block);
+    size_ += block->end;
+    size -= block->end;
+  }
+  trim();
+}
+
+uint32_t ByteBuffer::pin(size_t size)
+{
+  Pin pin;
+  pin.id = nextPin_++;
+  for (Block *block = head_;block && (size > 0);block = block->next) {
+    size_t length = block->end - block->begin;
+    if (length == 0) {
+      continue;
+    }
+    ++block->pins;
+    pin.blocks.push_back(block);
+    size -= min(size,length);
+  }
+  pins_.push_back(std::move(pin));
+  return pins_.back().id;
+}
+
+void ByteBuffer::unpin(uint32_t first, uint32_t last)
+{
+  // Completions normally arrive in order, so the matching pins are usually at the front
+  deque<Pin>::iterator it = pins_.begin();
+  while (it != pins_.end()) {
+    if ((uint32_t)(it->id - first) <= (uint32_t)(last - first)) {
+      for (size_t i=0;i<it->blocks.size();++i) {
+        Block *block = it->blocks[i];
+        if ((--block->pins == 0) && block->retired) {
+          release(block);
+        }
+      }
+      it = pins_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+size_t ByteBuffer::iovecs(struct iovec *iov, size_t count, size_t limit) const
+{
+  size_t result = 0;
+  for (Block *block = head_;block && (result < count) && (limit > 0);block = block->next) {
+    size_t length = min(block->end - block->begin,limit);
+    if (length == 0) {
+      continue;
+    }
+    iov[result].iov_base = block->base + block->begin;
+    iov[result].iov_len = length;
+    limit -= length;
+    ++result;
+  }
+  return result;
+}
+
+} // namespace tcp
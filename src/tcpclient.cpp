@@ -64,6 +64,7 @@ bool Client::connect(const char *host, const char *service)
       if (errno == EINPROGRESS) {
         state_ = SocketState::CONNECTING;
         setEvents(EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+        enableEvents();
         mtx.unlock();
         return true;
       } else {
@@ -94,6 +95,8 @@ void Client::connected() {
   }
     
   state_ = SocketState::CONNECTED;
+  // A blocking client connects without waiting for an event, so it is registered here
+  enableEvents();
   log("Connected");
 }
 
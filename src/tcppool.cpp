@@ -0,0 +1,230 @@
+#include "tcppool.h"
+#include "tcpsocket.h"
+#include <string.h>
+#include <sys/mman.h>
+
+namespace tcp {
+
+using namespace std;
+
+// The pool that the calling thread allocates from without locking
+static thread_local BlockPool *currentPool = nullptr;
+
+static const size_t CACHE_LINE = 64;
+
+BlockPool::Scope::Scope(BlockPool &pool) : previous_(currentPool)
+{
+  currentPool = &pool;
+}
+
+BlockPool::Scope::~Scope()
+{
+  currentPool = previous_;
+}
+
+BlockPool::BlockPool(size_t size) : size_(size)
+{
+  stride_ = (max<size_t>(size,sizeof(void*)) + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+  offset_ = (sizeof(Slab) + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+  capacity_ = (stride_ <= SLAB_SIZE - offset_) ? (SLAB_SIZE - offset_) / stride_ : 0;
+}
+
+BlockPool::~BlockPool()
+{
+  for (size_t i=0;i<slabs_.size();++i) {
+    ::munmap(slabs_[i],SLAB_SIZE);
+  }
+}
+
+bool BlockPool::owned() const
+{
+  return currentPool == this;
+}
+
+BlockPoolStats BlockPool::stats() const
+{
+  BlockPoolStats result;
+  result.hits = hits_.load(memory_order_relaxed);
+  result.misses = misses_.load(memory_order_relaxed);
+  result.bytesHeld = bytesHeld_.load(memory_order_relaxed);
+  result.bytesInUse = bytesInUse_.load(memory_order_relaxed);
+  return result;
+}
+
+void *BlockPool::allocate()
+{
+  if ((currentPool != this) || (capacity_ == 0)) {
+    misses_.fetch_add(1,memory_order_relaxed);
+    return nullptr;
+  }
+  if (!partial_) {
+    reclaim();
+  }
+  if (partial_) {
+    hits_.fetch_add(1,memory_order_relaxed);
+  } else {
+    misses_.fetch_add(1,memory_order_relaxed);
+    if ((slabs_.size() + 1) * SLAB_SIZE > limit_) {
+      return nullptr;
+    }
+    if (!map()) {
+      return nullptr;
+    }
+  }
+  Slab *slab = partial_;
+  void *block = slab->free;
+  slab->free = *reinterpret_cast<void**>(block);
+  ++slab->used;
+  --freeBlocks_;
+  if (!slab->free) {
+    unlist(slab);
+  }
+  bytesInUse_.fetch_add(stride_,memory_order_relaxed);
+  return block;
+}
+
+void BlockPool::release(void *block)
+{
+  if (currentPool == this) {
+    free(block);
+    return;
+  }
+  // Only the owning thread touches the slabs. Other threads hand the block back through returned_.
+  void *head = returned_.load(memory_order_relaxed);
+  do {
+    *reinterpret_cast<void**>(block) = head;
+  } while (!returned_.compare_exchange_weak(head,block,memory_order_release,memory_order_relaxed));
+}
+
+void BlockPool::trim()
+{
+  reclaim();
+  size_t i = 0;
+  while (i < slabs_.size()) {
+    if (slabs_[i]->used == 0) {
+      unmap(slabs_[i]);  // Moves the last slab into position i
+    } else {
+      ++i;
+    }
+  }
+}
+
+void BlockPool::free(void *block)
+{
+  Slab *slab = slabOf(block);
+  *reinterpret_cast<void**>(block) = slab->free;
+  slab->free = block;
+  --slab->used;
+  ++freeBlocks_;
+  bytesInUse_.fetch_sub(stride_,memory_order_relaxed);
+  if (!slab->listed) {
+    list(slab);
+  }
+  if ((slab->used == 0) && (freeBlocks_ * stride_ > trimThreshold_)) {
+    unmap(slab);
+  }
+}
+
+void BlockPool::reclaim()
+{
+  // Taking the whole list at once means a block can never be popped while another thread pushes it
+  void *block = returned_.exchange(nullptr,memory_order_acquire);
+  while (block) {
+    void *next = *reinterpret_cast<void**>(block);
+    free(block);
+    block = next;
+  }
+}
+
+BlockPool::Slab *BlockPool::map()
+{
+  // Slabs are aligned to SLAB_SIZE so that slabOf() can find the slab of a block from its address
+  void *memory = MAP_FAILED;
+  if (hugePages_ == HugePages::EXPLICIT) {
+    memory = ::mmap(nullptr,SLAB_SIZE,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,-1,0);
+    if (memory == MAP_FAILED) {
+      warning("BlockPool","No huge pages are available. Falling back to transparent huge pages.");
+      hugePages_ = HugePages::TRANSPARENT;
+    }
+  }
+  if (memory == MAP_FAILED) {
+    void *region = ::mmap(nullptr,2 * SLAB_SIZE,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if (region == MAP_FAILED) {
+      error("mmap",strerror(errno));
+      return nullptr;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(region);
+    uintptr_t aligned = (start + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1);
+    if (aligned > start) {
+      ::munmap(region,aligned - start);
+    }
+    if (aligned + SLAB_SIZE < start + 2 * SLAB_SIZE) {
+      ::munmap(reinterpret_cast<void*>(aligned + SLAB_SIZE),start + SLAB_SIZE - aligned);
+    }
+    memory = reinterpret_cast<void*>(aligned);
+    if (hugePages_ == HugePages::TRANSPARENT) {
+      ::madvise(memory,SLAB_SIZE,MADV_HUGEPAGE);
+    }
+  }
+  Slab *slab = static_cast<Slab*>(memory);
+  slab->next = nullptr;
+  slab->prev = nullptr;
+  slab->used = 0;
+  slab->listed = false;
+  slab->index = slabs_.size();
+  // Link the blocks from the end so that they are handed out in address order
+  slab->free = nullptr;
+  uint8_t *base = static_cast<uint8_t*>(memory) + offset_;
+  for (size_t i=capacity_;i>0;--i) {
+    void *block = base + (i - 1) * stride_;
+    *reinterpret_cast<void**>(block) = slab->free;
+    slab->free = block;
+  }
+  slabs_.push_back(slab);
+  freeBlocks_ += capacity_;
+  bytesHeld_.fetch_add(SLAB_SIZE,memory_order_relaxed);
+  list(slab);
+  return slab;
+}
+
+void BlockPool::unmap(Slab *slab)
+{
+  if (slab->listed) {
+    unlist(slab);
+  }
+  size_t index = slab->index;
+  slabs_[index] = slabs_.back();
+  slabs_[index]->index = index;
+  slabs_.pop_back();
+  freeBlocks_ -= capacity_;
+  bytesHeld_.fetch_sub(SLAB_SIZE,memory_order_relaxed);
+  ::munmap(slab,SLAB_SIZE);
+}
+
+void BlockPool::list(Slab *slab)
+{
+  slab->prev = nullptr;
+  slab->next = partial_;
+  if (partial_) {
+    partial_->prev = slab;
+  }
+  partial_ = slab;
+  slab->listed = true;
+}
+
+void BlockPool::unlist(Slab *slab)
+{
+  if (slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    partial_ = slab->next;
+  }
+  if (slab->next) {
+    slab->next->prev = slab->prev;
+  }
+  slab->next = nullptr;
+  slab->prev = nullptr;
+  slab->listed = false;
+}
+
+} // namespace tcp
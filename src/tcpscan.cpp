@@ -0,0 +1,103 @@
+#include "tcpscan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TCP_SCAN_X86
+#endif
+
+namespace tcp {
+
+typedef const uint8_t *(*FindFunction)(const uint8_t*, const uint8_t*, uint8_t);
+
+const uint8_t *findByteScalar(const uint8_t *begin, const uint8_t *end, uint8_t byte)
+{
+  while ((begin < end) && (*begin != byte)) {
+    ++begin;
+  }
+  return begin;
+}
+
+#ifdef TCP_SCAN_X86
+
+__attribute__((target("sse2")))
+static const uint8_t *findByteSSE2(const uint8_t *begin, const uint8_t *end, uint8_t byte)
+{
+  const __m128i needle = _mm_set1_epi8((char)byte);
+  while (end - begin >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk,needle));
+    if (mask) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 16;
+  }
+  return findByteScalar(begin,end,byte);
+}
+
+__attribute__((target("avx2")))
+static const uint8_t *findByteAVX2(const uint8_t *begin, const uint8_t *end, uint8_t byte)
+{
+  const __m256i needle = _mm256_set1_epi8((char)byte);
+  // Two vectors per iteration keep both load ports busy on long records
+  while (end - begin >= 64) {
+    __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin)),needle);
+    __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + 32)),needle);
+    if (!_mm256_testz_si256(_mm256_or_si256(a,b),_mm256_or_si256(a,b))) {
+      unsigned mask = (unsigned)_mm256_movemask_epi8(a);
+      if (mask) {
+        return begin + __builtin_ctz(mask);
+      }
+      return begin + 32 + __builtin_ctz((unsigned)_mm256_movemask_epi8(b));
+    }
+    begin += 64;
+  }
+  while (end - begin >= 32) {
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin)),needle));
+    if (mask) {
+      return begin + __builtin_ctz(mask);
+    }
+    begin += 32;
+  }
+  return findByteSSE2(begin,end,byte);
+}
+
+#endif
+
+static ScanKernel selectKernel()
+{
+#ifdef TCP_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return ScanKernel::AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return ScanKernel::SSE2;
+  }
+#endif
+  return ScanKernel::SCALAR;
+}
+
+static FindFunction selectFunction(ScanKernel kernel)
+{
+  switch (kernel) {
+#ifdef TCP_SCAN_X86
+    case ScanKernel::AVX2: return findByteAVX2;
+    case ScanKernel::SSE2: return findByteSSE2;
+#endif
+    default: return findByteScalar;
+  }
+}
+
+static const ScanKernel kernel = selectKernel();
+static const FindFunction findFunction = selectFunction(kernel);
+
+const uint8_t *findByte(const uint8_t *begin, const uint8_t *end, uint8_t byte)
+{
+  return findFunction(begin,end,byte);
+}
+
+ScanKernel scanKernel()
+{
+  return kernel;
+}
+
+} // namespace tcp
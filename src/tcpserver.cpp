@@ -8,7 +8,9 @@
 #include <sys/epoll.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <linux/filter.h>
 #include <unistd.h>
+#include <algorithm>
 #include "tcpserver.h"
 
 namespace tcp {
@@ -18,14 +20,168 @@ using namespace std;
 Server::~Server() {
   if (listening())
     stop();
+  trimSessionPool(0);
+  if (workers_) {
+    delete workers_;
+    workers_ = nullptr;
+  }
+  if (pool_) {
+    delete pool_;
+    pool_ = nullptr;
+  }
+}
+
+void Server::setThreads(size_t count, BalancePolicy policy)
+{
+  mtx.lock();
+  if (listening()) {
+    error("setThreads","Server is already listening");
+  } else {
+    if (pool_) {
+      delete pool_;
+    }
+    pool_ = new EPollPool(count,100,epoll().backend(),epoll().edgeTriggered());
+    policy_ = policy;
+  }
+  mtx.unlock();
+}
+
+void Server::setWorkers(size_t count)
+{
+  mtx.lock();
+  if (listening()) {
+    error("setWorkers","Server is already listening");
+  } else {
+    if (workers_) {
+      delete workers_;
+    }
+    workers_ = new WorkerPool(count);
+  }
+  mtx.unlock();
+}
+
+void Server::setSessionPoolSize(size_t count)
+{
+  mtx.lock();
+  sessionPoolSize_ = count;
+  trimSessionPool(count);
+  mtx.unlock();
+}
+
+size_t Server::pooledSessions()
+{
+  mtx.lock();
+  size_t result = pooled_;
+  mtx.unlock();
+  return result;
+}
+
+void Server::trimSessionPool(size_t count)
+{
+  mtx.lock();
+  std::map<EPoll*,vector<Session*>>::iterator it;
+  for (it = sessionPool_.begin();(it != sessionPool_.end()) && (pooled_ > count);++it) {
+    while (!it->second.empty() && (pooled_ > count)) {
+      delete it->second.back();
+      it->second.pop_back();
+      --pooled_;
+    }
+  }
+  mtx.unlock();
+}
+
+bool Server::recycle(Session *session)
+{
+  // dispose() is only called once the zero copy sends of a session have completed. A session that 
+  // still has blocks pinned lost its handle before their completions could be read. It is deleted, and
+  // ByteBuffer leaves those blocks allocated.
+  mtx.lock();
+  bool result = (pooled_ < sessionPoolSize_) && (session->zeroCopyPending() == 0);
+  if (result) {
+    sessions.erase(session->handle_);
+    session->handle_ = SessionHandle();
+    session->recycle();
+    sessionPool_[&session->epoll()].push_back(session);
+    ++pooled_;
+  }
+  mtx.unlock();
+  return result;
 }
 
-void Server::start(in_port_t port, char *bindaddress, bool useSSL, int backlog)
+Session *Server::reuse(EPoll &epoll)
 {
-  start(port,string(bindaddress),useSSL,backlog);
+  Session *result = nullptr;
+  if (pooled_ > 0) {
+    std::map<EPoll*,vector<Session*>>::iterator it = sessionPool_.find(&epoll);
+    if ((it != sessionPool_.end()) && !it->second.empty()) {
+      result = it->second.back();
+      it->second.pop_back();
+      --pooled_;
+    }
+  }
+  return result;
+}
+
+bool Server::withSession(SessionHandle handle, const function<void(Session&)> &fn)
+{
+  // A session that is disconnecting may hold its own mutex while it waits for mtx to leave sessions,
+  // so the session mutex is only tried, and mtx released until the session is free or gone
+  Session *session = nullptr;
+  for (;;) {
+    mtx.lock();
+    Session **found = sessions.find(handle);
+    session = found ? *found : nullptr;
+    if (!session || session->mtx.try_lock()) {
+      break;
+    }
+    mtx.unlock();
+    this_thread::yield();
+  }
+  if (session) {
+    fn(*session);
+    session->mtx.unlock();
+  }
+  mtx.unlock();
+  return session != nullptr;
+}
+
+void Server::forEachSession(const function<void(Session&)> &fn)
+{
+  mtx.lock();
+  vector<SessionHandle> handles;
+  handles.reserve(sessions.size());
+  for (SlotMap<Session*>::iterator it = sessions.begin();it != sessions.end();++it) {
+    handles.push_back((*it)->handle_);
+  }
+  mtx.unlock();
+  for (size_t i=0;i<handles.size();++i) {
+    withSession(handles[i],fn);
+  }
+}
+
+size_t Server::sessionCount()
+{
+  mtx.lock();
+  size_t result = sessions.size();
+  mtx.unlock();
+  return result;
+}
+
+EPoll &Server::selectEPoll()
+{
+  if (pool_) {
+    return pool_->select(policy_);
+  } else {
+    return epoll();
+  }
+}
+
+bool Server::start(in_port_t port, char *bindaddress, bool useSSL, int backlog)
+{
+  return start(port,string(bindaddress),useSSL,backlog);
 } 
 
-void Server::start(in_port_t port, string bindaddress, bool useSSL, int backlog)
+bool Server::start(in_port_t port, string bindaddress, bool useSSL, int backlog)
 {
   mtx.lock();
   useSSL_ = useSSL;
@@ -54,22 +210,143 @@ void Server::start(in_port_t port, string bindaddress, bool useSSL, int backlog)
   int enable = 1;
   if (setsockopt(socket(), SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0)
     error("setsockopt","Server could not set socket option SO_REUSEADDR");  
+  // The Listeners cannot bind to the port held by the server socket unless it also sets SO_REUSEPORT
+  if (sharded_ && (setsockopt(socket(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0))
+    error("setsockopt","Server could not set socket option SO_REUSEPORT");  
 
+  bool result = false;
   if (bindToAddress((struct sockaddr*)&addr_,(domain() == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6)))) {
-    startListening(backlog);
+    if (startListening(backlog)) {
+      result = true;
+      if (workers_) {
+        workers_->start();
+      }
+      if (pool_) {
+        if (sharded_) {
+          result = startListeners(backlog);
+        }
+        if (result) {
+          pool_->start();
+        } else {
+          // A server missing some of its listeners would only accept a share of its connections
+          if (workers_) {
+            workers_->stop();
+          }
+          pool_->stop();
+          stopListeners();
+        }
+      }
+    }
   }
   mtx.unlock();
+  if (!result) {
+    disconnect();
+  }
+  return result;
+}
+
+void Server::setSharding(bool enabled, bool steerByCPU)
+{
+  mtx.lock();
+  if (listening()) {
+    error("setSharding","Server is already listening");
+  } else {
+    sharded_ = enabled;
+    steerByCPU_ = enabled && steerByCPU;
+  }
+  mtx.unlock();
+}
+
+bool Server::startListeners(int backlog)
+{
+  socklen_t len = (domain() == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+  int enable = 1;
+  for (size_t i=0;i<pool_->size();++i) {
+    Listener *listener = new Listener((*pool_)[i],*this);
+    listeners_.push_back(listener);
+    if ((setsockopt(listener->socket(), SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) ||
+        (setsockopt(listener->socket(), SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)) {
+      error("setsockopt",strerror(errno));
+      return false;
+    }
+    if (::bind(listener->socket(),(struct sockaddr*)&addr_,len) == -1) {
+      error("bind",strerror(errno));
+      return false;
+    }
+    if (!listener->listen(backlog)) {
+      return false;
+    }
+  }
+  log("Server started " + to_string(listeners_.size()) + " sharded listeners");
+  if (steerByCPU_) {
+    pool_->setAffinity(true);
+    return attachCPUSteering();
+  }
+  return true;
+}
+
+void Server::stopListeners()
+{
+  for (size_t i=0;i<listeners_.size();++i) {
+    delete listeners_[i];
+  }
+  listeners_.clear();
+}
+
+bool Server::attachCPUSteering()
+{
+  // The reuseport group is indexed in listen() order, so the listener for pool thread i is i. Thread i
+  // is pinned to CPU i, so return the receiving CPU. The kernel falls back to hashing when the index is 
+  // out of range. The program is attached to the group through any of its members.
+  struct sock_filter code[] = {
+    { BPF_LD  | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },
+    { BPF_RET | BPF_A, 0, 0, 0 }
+  };
+  struct sock_fprog prog;
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+  if (listeners_.empty() ||
+      (setsockopt(listeners_.front()->socket(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)) {
+    error("setsockopt","Server could not attach SO_ATTACH_REUSEPORT_CBPF program: " + string(strerror(errno)));
+    return false;
+  }
+  return true;
 }
 
 void Server::stop()
 { 
   if (listening()) {
+    // Join the worker and pool threads first so no session is being serviced while it is disconnected.
+    // The workers finish their queued tasks while the pool threads are still sending.
+    if (workers_) {
+      workers_->stop();
+    }
+    if (pool_) {
+      pool_->stop();
+    }
     log("Sending disconnect to all sessions");
     mtx.lock();
-    std::map<int,Session*>::iterator it;
-    for (it = sessions.begin();it != sessions.end();++it) {
-      it->second->disconnect();
+    vector<Session*> list(sessions.begin(),sessions.end());
+    for (size_t i=0;i<list.size();++i) {
+      list[i]->disconnect();
+    }
+    // Sessions disconnected off their polling thread are freed by tasks posted to their EPoll instances,
+    // and sends posted by the workers keep their sessions alive. Run those tasks now so that the sessions
+    // are deleted while the server still exists.
+    if (pool_) {
+      for (size_t i=0;i<pool_->size();++i) {
+        (*pool_)[i].drainTasks();
+      }
+    }
+    epoll().drainTasks();
+    // Sessions still waiting for zerocopy sends to complete would otherwise be disposed of after the
+    // server has been deleted
+    vector<Session*> lingering(lingering_);
+    for (size_t i=0;i<lingering.size();++i) {
+      lingering[i]->stopLingering();
     }
+    stopListeners();
+    trimSessionPool(0);
     mtx.unlock();
   }
   disconnect();
@@ -77,7 +354,7 @@ void Server::stop()
 
 void Server::handleEvents(uint32_t events) {
   if (listening() && (events & EPOLLIN)) {
-    acceptConnection();
+    acceptConnections(socket(),nullptr);
   }
 }
 
@@ -184,48 +461,175 @@ bool Server::bindToAddress(sockaddr *addr, socklen_t len) {
 }
 
 bool Server::startListening(int backlog) {
+  if (sharded_ && pool_) {
+    // The server socket only reserves the port. If it listened it would join the reuseport group of
+    // the Listeners and take a share of the connections onto the thread polling epoll().
+    state_ = SocketState::LISTENING;
+    log("Server started listening");
+    return true;
+  }
   if (listen(socket(),backlog) == -1) {
     error("listen",strerror(errno));
     return false;
   } else {
     state_ = SocketState::LISTENING;
+    if (epoll().backend() == EPollBackend::IO_URING) {
+      // Use a multishot accept instead of a readiness poll
+      setEvents(0);
+      enableEvents();
+      submit(IOOperation::ACCEPT);
+    } else {
+      enableEvents();
+    }
     log("Server started listening");
     return true;
   }
 }
 
-bool Server::acceptConnection() {
+void Server::acceptConnections(int listener, EPoll *target) {
+  // An edge triggered listener is not notified again until the backlog has been drained
+  size_t limit = epoll().edgeTriggered() ? 0 : acceptBatch_;
+  size_t count = 0;
+  while (listening() && ((limit == 0) || (count < limit)) && acceptConnection(listener,target)) {
+    ++count;
+  }
+}
+
+bool Server::acceptConnection(int listener, EPoll *target) {
   struct sockaddr_in peer_addr;
   socklen_t peer_addr_len = sizeof(struct sockaddr_in);
-  mtx.lock();
-  int conn_sock = ::accept(socket(),(struct sockaddr *) &peer_addr, &peer_addr_len);
+  // The new socket is created non-blocking, so Session does not need to call fcntl()
+  int conn_sock = ::accept4(listener,(struct sockaddr *) &peer_addr, &peer_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
   if (conn_sock == -1) {
-    error("accept",strerror(errno));
-    mtx.unlock();
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+      error("accept4",strerror(errno));
+    }
     return false;
   } else {
-    // Delete any existing sessions with the same socket handle
-    Session* session = sessions[conn_sock];
-    sessions.erase(conn_sock);
-    if (session != nullptr) {
-      warning("A session with socket handle " + to_string(conn_sock) + " already exists. Deleting it.");
-      delete session;
-    } 
-    // Start a new session and accept it
-    session = createSession(conn_sock,peer_addr);
-    sessions[conn_sock] = session;
-    session->accepted();
-    mtx.unlock();
-    return session->connected();
+    // Only choose an EPoll instance once there is a connection, so the round robin is not advanced by EAGAIN
+    startSession(conn_sock,peer_addr,target ? *target : selectEPoll());
+    return true;
+  }
+}
+
+void Server::handleCompletion(IOOperation op, int result, bool more, const uint8_t *data) {
+  (void)data;
+  if (op == IOOperation::ACCEPT) {
+    completeAccept(result,nullptr);
+    if (!more && listening()) {
+      submit(IOOperation::ACCEPT);
+    }
+  }
+}
+
+void Server::completeAccept(int result, EPoll *target) {
+  if (result >= 0) {
+    struct sockaddr_in peer_addr;
+    socklen_t peer_addr_len = sizeof(struct sockaddr_in);
+    memset(&peer_addr,0,sizeof(peer_addr));
+    getpeername(result,(struct sockaddr *) &peer_addr, &peer_addr_len);
+    // As in acceptConnection(), a failed accept does not advance the round robin
+    startSession(result,peer_addr,target ? *target : selectEPoll());
+  } else if (result != -ECANCELED) {
+    error("accept",strerror(-result));
+  }
+}
+
+void Server::startSession(int conn_sock, const sockaddr_in &peer_addr, EPoll &epoll) {
+  mtx.lock();
+  // Start a new session and accept it. The server lock is released first because the session
+  // may already be receiving events on another thread.
+  Session *session = reuse(epoll);
+  if (session) {
+    session->reopen(conn_sock,peer_addr);
+  } else {
+    session = createSession(epoll,conn_sock,peer_addr);
+  }
+  session->setWorkerPool(workers_);
+  session->handle_ = sessions.insert(session);
+  mtx.unlock();
+  session->accepted();
+}
+
+/* Listener */
+
+Listener::Listener(EPoll &epoll, Server &server) : Socket(epoll,server.domain(),0,false,EPOLLIN), server_(server)
+{
+  state_ = SocketState::LISTENING;
+}
+
+bool Listener::listen(int backlog)
+{
+  if (::listen(socket(),backlog) == -1) {
+    error("listen",strerror(errno));
+    return false;
+  }
+  if (epoll().backend() == EPollBackend::IO_URING) {
+    setEvents(0);
+    enableEvents();
+    submit(IOOperation::ACCEPT);
+  } else {
+    enableEvents();
+  }
+  return true;
+}
+
+void Listener::handleEvents(uint32_t events) 
+{
+  if (server_.listening() && (events & EPOLLIN)) {
+    server_.acceptConnections(socket(),&epoll());
+  }
+}
+
+void Listener::handleCompletion(IOOperation op, int result, bool more, const uint8_t *data)
+{
+  (void)data;
+  if (op == IOOperation::ACCEPT) {
+    server_.completeAccept(result,&epoll());
+    if (!more && server_.listening()) {
+      submit(IOOperation::ACCEPT);
+    }
   }
 }
 
 /* Session */
 
 Session::~Session() {
-  mtx.lock(); 
-  server_.sessions.erase(socket());
-  mtx.unlock();
+  server_.mtx.lock(); 
+  server_.sessions.erase(handle_);
+  server_.mtx.unlock();
+  if (ssl_) {
+    delete ssl_;
+    ssl_ = nullptr;
+  }
+}
+
+void Session::reopen(const int socket, const struct sockaddr_in &peer_addr)
+{
+  port_ = peer_addr.sin_port;
+  addr_ = peer_addr.sin_addr.s_addr;
+  attach(socket,epoll().edgeTriggered() ? (EPOLLIN | EPOLLRDHUP | EPOLLOUT) : (EPOLLIN | EPOLLRDHUP));
+  reset();
+}
+
+void Session::lingerStarted()
+{
+  server_.mtx.lock();
+  server_.lingering_.push_back(this);
+  server_.mtx.unlock();
+}
+
+void Session::dispose()
+{
+  server_.mtx.lock();
+  vector<Session*>::iterator it = std::find(server_.lingering_.begin(),server_.lingering_.end(),this);
+  if (it != server_.lingering_.end()) {
+    server_.lingering_.erase(it);
+  }
+  server_.mtx.unlock();
+  if (!server_.recycle(this)) {
+    delete this;
+  }
 }
 
 void Session::connectionMessage(string action)
@@ -248,24 +652,32 @@ void Session::connectionMessage(string action)
 void Session::accepted() {
   mtx.lock();
   connectionMessage("accepted");
+  bool handshake = true;
   if (server().useSSL_) {
-    ssl_ = createSSL(server().ctx());
+    if (!ssl_) {
+      ssl_ = createSSL(server().ctx());
+    }
     ssl_->setfd(socket());
-    if (ssl_->accept())
-      state_ = SocketState::CONNECTED;
-    else
-      disconnected();
-  } else {
-    state_ = SocketState::CONNECTED;
+    handshake = ssl_->accept();
+  }
+  state_ = SocketState::CONNECTED;
+  // Events are enabled only now, so none is ignored because the session was not yet connected
+  if (handshake) {
+    enableEvents();
   }
   mtx.unlock();
+  // A failed handshake closes the session. disconnected() takes the server mutex, which must not be
+  // waited for while holding mtx.
+  if (!handshake) {
+    disconnected();
+  }
 }
 
 /** @brief   Starts a graceful shutdown of the session 
  *  Override disconnect() to send any last messages required before the session is terminated.
  *  Be sure to call flush() to ensure the data is actually written to the write buffer. */
 void Session::disconnect() {
-  if (ssl_) {
+  if (ssl_ && connected()) {
     mtx.lock();
     ssl_->shutdown();
     printSSLErrors();    
@@ -278,16 +690,21 @@ void Session::disconnect() {
  *  Override disconnected() to perform cleanup operations when a connection is unexpectedly lost */
 void Session::disconnected() {
   if (connected()) {
+    // Leave the sessions first, so that the server no longer hands out a session that is closing
+    server_.mtx.lock();
+    server_.sessions.erase(handle_);
+    server_.mtx.unlock();
     mtx.lock(); 
-    if (ssl_) {
+    // A pooled session keeps its SSL object for the next connection
+    if (ssl_ && (server_.sessionPoolSize() == 0)) {
       delete ssl_;
       ssl_ = nullptr;
       printSSLErrors();
     }
     state_ = SocketState::DISCONNECTED;
     connectionMessage("disconnected");
-    delete this;
     mtx.unlock();
+    destroy();
   }  
 }
 
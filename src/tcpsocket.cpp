@@ -1,14 +1,23 @@
 #include "tcpsocket.h"
+#include "tcpuring.h"
 #include <algorithm>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <climits>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <linux/errqueue.h>
 
 namespace tcp {
 
@@ -22,79 +31,625 @@ void warning(string label, string msg) { logstream << "Warning: " << label << ":
 void log(string msg) { logstream << msg << endl; }
 void log(string label, string msg) { logstream << label << ": " << msg << endl;}
 
-EPoll::EPoll() 
+// epoll event data and io_uring user data layout: socket handle (32 bits) | socket tag (16 bits) | poll sequence (8 bits) | operation (8 bits)
+// Events and completions whose socket handle and tag no longer match a registered socket are discarded.
+enum : uint8_t { OP_NONE=0, OP_POLL, OP_ACCEPT, OP_RECV, OP_SEND, OP_TIMER, OP_WAKE };
+
+// Milliseconds on the clock used by timerfd
+static uint64_t monotonicTime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+EPoll::EPoll(EPollBackend backend, bool edgeTriggered) : backend_(backend), edgeTriggered_(edgeTriggered)
 {
-  handle_ = epoll_create1(0);
-  if (handle_ == -1) {
-    error("epoll_create1",strerror(errno));
+  if (backend_ == EPollBackend::IO_URING) {
+    ring_ = new Ring();
+    if (ring_->valid()) {
+      edgeTriggered_ = false;
+    } else {
+      warning("EPoll","io_uring is not available. Falling back to epoll.");
+      delete ring_;
+      ring_ = nullptr;
+      backend_ = EPollBackend::EPOLL;
+    }
+  }
+  if (!ring_) {
+    handle_ = epoll_create1(0);
+    if (handle_ == -1) {
+      error("epoll_create1",strerror(errno));
+    }
   }
+  startTimers();
+  startTasks();
 }
 
 EPoll::~EPoll() 
 {
-  sockets.clear();
+  // Tasks that were never run may refer to sockets that still need this instance when they are deleted
+  Task *task;
+  while ((task = tasks_.pop()) != nullptr) {
+    delete task;
+  }
+  slots_ = nullptr;
+  tables_.clear();
+  if (ring_) {
+    delete ring_;
+    ring_ = nullptr;
+  }
+  if (timerfd_ != -1) {
+    ::close(timerfd_);
+  }
+  delete timers_;
+  if (eventfd_ != -1) {
+    ::close(eventfd_);
+  }
   if (handle_ > 0) {
     ::close(handle_);
   }
 }
 
+uint64_t EPoll::userData(const Socket& socket, uint8_t op)
+{
+  return ((uint64_t)(uint32_t)socket.socket_ << 32) | ((uint64_t)socket.tag_ << 16) | ((uint64_t)socket.pollSeq_ << 8) | op;
+}
+
 bool EPoll::add(Socket& socket, int events) 
 {
-  struct epoll_event ev;
+  if (socket.socket_ < 0) {
+    return false;
+  }
+  // The slot is filled before the handle is added, because the kernel may report an event for it, 
+  // such as data that has already arrived, to another thread as soon as epoll_ctl() returns
+  mtx.lock();
+  if (++tags_ == 0) {
+    ++tags_;
+  }
+  socket.tag_ = tags_;
+  size_t fd = socket.socket_;
+  setSlot(fd,&socket);
+  mtx.unlock();
+  socket.registered_ = true;
   bool result = false;
-  ev.events = events;
-  ev.data.fd = socket.socket_;
-  if (epoll_ctl(handle_,EPOLL_CTL_ADD,socket.socket_,&ev) != -1) {
-    sockets[socket.socket_] = &socket;
-    result = true;
-  } 
+  if (ring_) {
+    socket.polling_ = false;
+    result = arm(socket,events);
+  } else {
+    struct epoll_event ev;
+    ev.events = edgeTriggered_ ? (events | EPOLLET) : events;
+    ev.data.u64 = userData(socket,OP_NONE);
+    result = (epoll_ctl(handle_,EPOLL_CTL_ADD,socket.socket_,&ev) != -1);
+  }
+  if (!result) {
+    socket.registered_ = false;
+    mtx.lock();
+    clearSlot(fd,&socket);
+    mtx.unlock();
+  }
   return result;
 }
 
 bool EPoll::update(Socket& socket, int events)
 {
+  if (ring_) {
+    return arm(socket,events);
+  }
   bool result;
   struct epoll_event ev;
-  ev.events = events;
-  ev.data.fd = socket.socket_;
+  ev.events = edgeTriggered_ ? (events | EPOLLET) : events;
+  ev.data.u64 = userData(socket,OP_NONE);
   result = (epoll_ctl(handle_,EPOLL_CTL_MOD,socket.socket_,&ev) != -1);
   return result;
 }
 
 bool EPoll::remove(Socket& socket) 
 {
+  if (!socket.registered_) {
+    return false;
+  }
+  socket.registered_ = false;
   bool result = false;
-  if (epoll_ctl(handle_,EPOLL_CTL_DEL,socket.socket_,NULL) != -1) {
-    sockets.erase(socket.socket_);
+  if (ring_) {
+    ring_->cancel(socket.socket_);
     result = true;
-  } 
+  } else {
+    result = (epoll_ctl(handle_,EPOLL_CTL_DEL,socket.socket_,NULL) != -1);
+  }
+  // The slot is cleared even if the handle was already gone, so that it cannot be dispatched to
+  mtx.lock();
+  clearSlot(socket.socket_,&socket);
+  mtx.unlock();
   return result;
 }
 
+void EPoll::setSlot(size_t fd, Socket *socket)
+{
+  SlotTable *table = slots_.load(memory_order_relaxed);
+  size_t size = table ? table->slots.size() : 0;
+  if (fd >= size) {
+    // Copy the slots to a larger table. Only the holder of mtx writes to the slots, so none change while 
+    // they are copied.
+    tables_.push_back(unique_ptr<SlotTable>(new SlotTable(max<size_t>(fd + 1,size * 2))));
+    SlotTable *larger = tables_.back().get();
+    for (size_t i=0;i<size;++i) {
+      larger->slots[i].store(table->slots[i].load(memory_order_relaxed),memory_order_relaxed);
+    }
+    slots_.store(larger,memory_order_release);
+    table = larger;
+  }
+  if (table->slots[fd].load(memory_order_relaxed) == 0) {
+    ++count_;
+  }
+  table->slots[fd].store(((uint64_t)(uintptr_t)socket << 16) | socket->tag_,memory_order_release);
+}
+
+void EPoll::clearSlot(size_t fd, Socket *socket)
+{
+  SlotTable *table = slots_.load(memory_order_relaxed);
+  if (table && (fd < table->slots.size()) && 
+      ((table->slots[fd].load(memory_order_relaxed) >> 16) == (uint64_t)(uintptr_t)socket)) {
+    table->slots[fd].store(0,memory_order_release);
+    --count_;
+  }
+}
+
+bool EPoll::arm(Socket& socket, int events)
+{
+  // io_uring polls are one shot and are re-armed after each event, which gives the same 
+  // level triggered behaviour as epoll. Changing the events replaces the armed poll.
+  bool result = true;
+  if (socket.polling_) {
+    result = ring_->pollRemove(userData(socket,OP_POLL));
+    socket.polling_ = false;
+  }
+  ++socket.pollSeq_;
+  if (events != 0) {
+    socket.polling_ = ring_->pollAdd(socket.socket_,events,userData(socket,OP_POLL));
+    result = result && socket.polling_;
+  }
+  submitted();
+  return result;
+}
+
+bool EPoll::submit(Socket& socket, IOOperation op)
+{
+  if (!ring_) {
+    return false;
+  }
+  bool result = false;
+  switch (op) {
+    case IOOperation::ACCEPT: result = ring_->accept(socket.socket_,userData(socket,OP_ACCEPT)); break;
+    case IOOperation::RECV: result = ring_->recv(socket.socket_,userData(socket,OP_RECV)); break;
+    default: break;
+  }
+  submitted();
+  return result;
+}
+
+bool EPoll::submitSend(Socket& socket, vector<uint8_t> &&buffer)
+{
+  if (!ring_) {
+    return false;
+  }
+  bool result = ring_->send(socket.socket_,std::move(buffer),userData(socket,OP_SEND));
+  submitted();
+  return result;
+}
+
+void EPoll::submitted()
+{
+  // Queued requests reach the kernel when the polling thread next calls Ring.wait(). A request queued
+  // by another thread, such as the poll armed for a session accepted elsewhere, would otherwise wait 
+  // for the poll timeout, so the polling thread is woken. It is not submitted here because io_uring 
+  // runs the task work of a request on the thread that submitted it.
+  if (!inPoll() && !wakePending_.exchange(true)) {
+    wake();
+  }
+}
+
+Socket *EPoll::find(int fd, uint16_t tag)
+{
+  // The socket and its tag are read as one value, so a slot that is being reused cannot pair the 
+  // tag of one socket with another
+  SlotTable *table = slots_.load(memory_order_acquire);
+  if (!table || ((size_t)fd >= table->slots.size())) {
+    return nullptr;
+  }
+  uint64_t slot = table->slots[fd].load(memory_order_acquire);
+  if ((slot == 0) || ((slot & 0xFFFF) != tag)) {
+    return nullptr;
+  }
+  return reinterpret_cast<Socket*>((uintptr_t)(slot >> 16));
+}
+
 void EPoll::poll(int timeout) 
 {  
-  int nfds = epoll_wait(handle_,events,MAX_EVENTS,timeout); 
-  if (nfds == -1) {
-    if (errno != EINTR) 
-      error("epoll_wait",strerror(errno));
+  BlockPool::Scope scope(pool_);
+  timeout = waitTime(timeout);
+  if (ring_) {
+    ring_->wait(timeout);
+    handleCompletions();
+  } else {
+    int nfds = epoll_wait(handle_,events,MAX_EVENTS,timeout); 
+    if (nfds == -1) {
+      if (errno != EINTR) 
+        error("epoll_wait",strerror(errno));
+    } else {
+      for (int n = 0; n < nfds; ++n) {
+        handleEvents(events[n].events,events[n].data.u64);
+      }
+    }
+  }
+  runTimers();
+  runTasks();
+  flushDirty();
+}
+
+void EPoll::flushDirty()
+{
+  // A socket flushed here may write to another, which is appended to the list and flushed in this pass
+  for (size_t i=0;i<dirty_.size();++i) {
+    dirty_[i]->flushDirty();
+  }
+  dirty_.clear();
+}
+
+void EPoll::startTimers()
+{
+  timers_ = new TimerWheel(monotonicTime());
+  timerfd_ = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timerfd_ == -1) {
+    error("timerfd_create",strerror(errno));
+    return;
+  }
+  uint64_t data = ((uint64_t)(uint32_t)timerfd_ << 32) | OP_TIMER;
+  if (ring_) {
+    ring_->pollAdd(timerfd_,EPOLLIN,data);
+  } else {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = data;
+    if (epoll_ctl(handle_,EPOLL_CTL_ADD,timerfd_,&ev) == -1) {
+      error("epoll_ctl",strerror(errno));
+    }
+  }
+}
+
+void EPoll::startTasks()
+{
+  eventfd_ = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventfd_ == -1) {
+    error("eventfd",strerror(errno));
+    return;
+  }
+  uint64_t data = ((uint64_t)(uint32_t)eventfd_ << 32) | OP_WAKE;
+  if (ring_) {
+    ring_->pollAdd(eventfd_,EPOLLIN,data);
   } else {
-    for (int n = 0; n < nfds; ++n) {
-      handleEvents(events[n].events,events[n].data.fd);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = data;
+    if (epoll_ctl(handle_,EPOLL_CTL_ADD,eventfd_,&ev) == -1) {
+      error("epoll_ctl",strerror(errno));
+    }
+  }
+}
+
+void EPoll::enqueue(Task *task)
+{
+  tasks_.push(task);
+  // Only the first task posted since the polling thread last woke signals the eventfd
+  if (!wakePending_.exchange(true)) {
+    wake();
+  }
+}
+
+void EPoll::wake()
+{
+  uint64_t value = 1;
+  if ((::write(eventfd_,&value,sizeof(value)) == -1) && (errno != EAGAIN)) {
+    error("eventfd write",strerror(errno));
+  }
+}
+
+void EPoll::runTasks()
+{
+  if (!wakePending_.load(memory_order_acquire)) {
+    return;
+  }
+  wakePending_.store(false);
+  Task *task;
+  int count = 0;
+  while ((task = tasks_.pop()) != nullptr) {
+    task->run();
+    delete task;
+    if (++count == MAX_TASKS) {
+      // Leave the rest for the next call so that tasks which post tasks cannot starve the sockets
+      if (!wakePending_.exchange(true)) {
+        wake();
+      }
+      break;
+    }
+  }
+}
+
+void EPoll::drainTasks()
+{
+  Task *task;
+  while ((task = tasks_.pop()) != nullptr) {
+    task->run();
+    delete task;
+  }
+}
+
+TimerId EPoll::setTimeout(unsigned delay, TimerCallback callback)
+{
+  return addTimer(delay,0,std::move(callback));
+}
+
+TimerId EPoll::setInterval(unsigned interval, TimerCallback callback)
+{
+  interval = max(interval,1U);
+  return addTimer(interval,interval,std::move(callback));
+}
+
+bool EPoll::cancelTimer(TimerId id)
+{
+  timerMtx.lock();
+  bool result = timers_->cancel(id);
+  timerMtx.unlock();
+  return result;
+}
+
+TimerId EPoll::addTimer(uint64_t delay, uint64_t interval, TimerCallback &&callback)
+{
+  timerMtx.lock();
+  TimerId result = timers_->add(monotonicTime() + delay,interval,std::move(callback));
+  // The timerfd wakes the polling thread if this timer is due before the wait it started with
+  uint64_t next = timers_->next();
+  if (next < deadline_) {
+    armTimerfd(next);
+  }
+  timerMtx.unlock();
+  return result;
+}
+
+int EPoll::waitTime(int timeout)
+{
+  timerMtx.lock();
+  uint64_t next = timers_->next();
+  timerMtx.unlock();
+  if (next == TimerWheel::NEVER) {
+    return timeout;
+  }
+  uint64_t now = monotonicTime();
+  uint64_t wait = (next > now) ? (next - now) : 0;
+  if ((timeout < 0) || (wait < (uint64_t)timeout)) {
+    return (int)min<uint64_t>(wait,INT_MAX);
+  }
+  return timeout;
+}
+
+void EPoll::runTimers()
+{
+  vector<shared_ptr<TimerCallback>> expired;
+  timerMtx.lock();
+  timers_->expire(monotonicTime(),expired);
+  uint64_t next = timers_->next();
+  if (next != deadline_) {
+    armTimerfd(next);
+  }
+  timerMtx.unlock();
+  for (size_t i=0;i<expired.size();++i) {
+    (*expired[i])();
+  }
+}
+
+void EPoll::armTimerfd(uint64_t deadline)
+{
+  if (timerfd_ == -1) {
+    return;
+  }
+  struct itimerspec spec;
+  memset(&spec,0,sizeof(spec));
+  if (deadline != TimerWheel::NEVER) {
+    spec.it_value.tv_sec = deadline / 1000;
+    spec.it_value.tv_nsec = (deadline % 1000) * 1000000L;
+  }
+  if (timerfd_settime(timerfd_,TFD_TIMER_ABSTIME,&spec,NULL) == -1) {
+    error("timerfd_settime",strerror(errno));
+  }
+  deadline_ = deadline;
+}
+
+void EPoll::readEventfd()
+{
+  // Read whenever the eventfd is reported, whatever the state of wakePending_. A thread that set 
+  // wakePending_ may write to the eventfd after runTasks() has cleared it, and an eventfd that is 
+  // left readable would end every wait immediately.
+  uint64_t value;
+  if ((::read(eventfd_,&value,sizeof(value)) == -1) && (errno != EAGAIN)) {
+    error("eventfd read",strerror(errno));
+  }
+}
+
+void EPoll::readTimerfd()
+{
+  // Expired timers are run at the end of poll(). This only clears the readable state.
+  uint64_t expirations;
+  while (::read(timerfd_,&expirations,sizeof(expirations)) > 0) {}
+}
+
+void EPoll::handleCompletions()
+{
+  struct io_uring_cqe cqe;
+  while (ring_->peek(cqe)) {
+    ring_->advance();
+    uint8_t op = cqe.user_data & 0xFF;
+    if (op == OP_NONE) {
+      continue;
+    }
+    if (op == OP_TIMER) {
+      readTimerfd();
+      ring_->pollAdd(timerfd_,EPOLLIN,cqe.user_data);
+      continue;
+    }
+    if (op == OP_WAKE) {
+      readEventfd();
+      ring_->pollAdd(eventfd_,EPOLLIN,cqe.user_data);
+      continue;
+    }
+    int fd = (int)(cqe.user_data >> 32);
+    uint16_t tag = (cqe.user_data >> 16) & 0xFFFF;
+    bool more = (cqe.flags & IORING_CQE_F_MORE);
+    Socket *socket = find(fd,tag);
+    switch (op) {
+      case OP_POLL:
+        if (socket && (((cqe.user_data >> 8) & 0xFF) == socket->pollSeq_)) {
+          socket->mtx.lock();
+          socket->polling_ = false;
+          socket->mtx.unlock();
+          if (cqe.res > 0) {
+            socket->handleEvents(cqe.res);
+          }
+          // The handler may have destroyed the socket or armed a new poll
+          socket = find(fd,tag);
+          if (socket) {
+            socket->mtx.lock();
+            if (!socket->polling_ && (socket->events_ != 0)) {
+              arm(*socket,socket->events_);
+            }
+            socket->mtx.unlock();
+          }
+        }
+        break;
+      case OP_ACCEPT:
+        if (socket) {
+          socket->handleCompletion(IOOperation::ACCEPT,cqe.res,more,nullptr);
+        } else if (cqe.res >= 0) {
+          ::close(cqe.res);
+        }
+        break;
+      case OP_RECV: {
+        uint8_t *data = nullptr;
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+          data = ring_->buffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        if (socket) {
+          socket->handleCompletion(IOOperation::RECV,cqe.res,more,data);
+        }
+        if (data) {
+          ring_->recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        }
+        break;
+      }
+      case OP_SEND:
+        if (ring_->sent(cqe.user_data,cqe.res) && socket) {
+          socket->handleCompletion(IOOperation::SEND,cqe.res,false,nullptr);
+        }
+        break;
     }
   }
 }
 
-void EPoll::handleEvents(uint32_t events, int fd) 
+void EPoll::handleEvents(uint32_t events, uint64_t data) 
 {
-  Socket* socket = sockets[fd];
+  if ((data & 0xFF) == OP_TIMER) {
+    readTimerfd();
+    return;
+  }
+  if ((data & 0xFF) == OP_WAKE) {
+    readEventfd();
+    return;
+  }
+  Socket* socket = find((int)(data >> 32),(data >> 16) & 0xFFFF);
   if (socket != nullptr) {
     socket->handleEvents(events);
   }
 }
 
+/* EPollPool */
+
+EPollPool::EPollPool(size_t count, int timeout, EPollBackend backend, bool edgeTriggered) : timeout_(timeout)
+{
+  if (count == 0) {
+    count = max<size_t>(thread::hardware_concurrency(),1);
+  }
+  for (size_t i=0;i<count;++i) {
+    epolls_.push_back(unique_ptr<EPoll>(new EPoll(backend,edgeTriggered)));
+  }
+}
+
+EPollPool::~EPollPool()
+{
+  stop();
+}
+
+void EPollPool::start()
+{
+  if (!running_) {
+    running_ = true;
+    for (size_t i=0;i<epolls_.size();++i) {
+      threads_.push_back(thread(&EPollPool::run,this,i));
+    }
+  }
+}
+
+void EPollPool::stop()
+{
+  if (running_) {
+    running_ = false;
+    for (size_t i=0;i<epolls_.size();++i) {
+      // Wake the thread so that it does not wait for the poll timeout
+      epolls_[i]->post([]{});
+    }
+    for (size_t i=0;i<threads_.size();++i) {
+      threads_[i].join();
+    }
+    threads_.clear();
+  }
+}
+
+EPoll &EPollPool::select(BalancePolicy policy)
+{
+  if (policy == BalancePolicy::LEAST_CONNECTIONS) {
+    size_t index = 0;
+    size_t least = epolls_[0]->size();
+    for (size_t i=1;i<epolls_.size();++i) {
+      size_t count = epolls_[i]->size();
+      if (count < least) {
+        least = count;
+        index = i;
+      }
+    }
+    return *epolls_[index];
+  } else {
+    return *epolls_[next_++ % epolls_.size()];
+  }
+}
+
+void EPollPool::run(size_t index)
+{
+  if (affinity_) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % max<size_t>(thread::hardware_concurrency(),1),&cpus);
+    int res = pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&cpus);
+    if (res != 0) {
+      error("pthread_setaffinity_np",strerror(res));
+    }
+  }
+  EPoll &epoll = *epolls_[index];
+  while (running_) {
+    epoll.poll(timeout_);
+  }
+}
+
 /* Socket */
 
-Socket::Socket(EPoll &epoll, const int domain, const int socket, const bool blocking, const int events) : epoll_(epoll), events_(events), domain_(domain), socket_(socket) 
+Socket::Socket(EPoll &epoll, const int domain, const int socket, const bool blocking, const int events, const bool accepted) : epoll_(epoll), events_(events), domain_(domain), socket_(socket) 
 { 
   if ((domain != AF_INET) && (domain != AF_INET6)) {
     error("Socket","Only IPv4 and IPv6 are supported.");
@@ -106,29 +661,26 @@ Socket::Socket(EPoll &epoll, const int domain, const int socket, const bool bloc
   }
   mtx.lock();
   if (socket == 0) {
-    socket_ = ::socket(domain,SOCK_STREAM,0);
+    // Setting the flags here saves two fcntl() calls
+    socket_ = ::socket(domain,SOCK_STREAM | SOCK_CLOEXEC | (blocking ? 0 : SOCK_NONBLOCK),0);
     if (socket_ == -1) {
       error("socket", strerror(errno));
     }
-  }
-  int flags = fcntl(socket_,F_GETFL,0);
-  if (flags == -1) {
-    error("fcntl (get)",strerror(errno));
-  } else {
-    if (!blocking) {
-      flags |= O_NONBLOCK;
+  } else if (!accepted) {
+    int flags = fcntl(socket_,F_GETFL,0);
+    if (flags == -1) {
+      error("fcntl (get)",strerror(errno));
     } else {
-      flags = flags & ~O_NONBLOCK;
-    }
-    if (fcntl(socket_,F_SETFL,flags) == -1) {
-      error("fcntl (set)",strerror(errno));
+      if (!blocking) {
+        flags |= O_NONBLOCK;
+      } else {
+        flags = flags & ~O_NONBLOCK;
+      }
+      if (fcntl(socket_,F_SETFL,flags) == -1) {
+        error("fcntl (set)",strerror(errno));
+      }
     }
   }
-  
-  if (!epoll_.add(*this,events)) {
-    error("Unable to add socket to epoll");
-  }
-  
   mtx.unlock();
 }
 
@@ -145,11 +697,29 @@ Socket::~Socket()
   }
 }
 
+bool Socket::enableEvents()
+{
+  mtx.lock();
+  bool result = registered_;
+  if (!result) {
+    result = epoll_.add(*this,events_);
+    if (!result) {
+      error("Unable to add socket to epoll");
+    }
+  }
+  mtx.unlock();
+  return result;
+}
+
 bool Socket::setEvents(int events) 
 { 
   mtx.lock();
   bool result = false;
-  if (events != events_) { 
+  if (!registered_) {
+    // Recorded for enableEvents()
+    events_ = events;
+    result = true;
+  } else if (events != events_) { 
     if (epoll_.update(*this,events)) { 
       events_ = events; 
       result = true;
@@ -161,6 +731,45 @@ bool Socket::setEvents(int events)
   return result;
 }
 
+void Socket::handleCompletion(IOOperation op, int result, bool more, const uint8_t *data)
+{
+  (void)op;
+  (void)result;
+  (void)more;
+  (void)data;
+}
+
+bool Socket::submit(IOOperation op)
+{
+  return epoll_.submit(*this,op);
+}
+
+bool Socket::submitSend(vector<uint8_t> &&buffer)
+{
+  return epoll_.submitSend(*this,std::move(buffer));
+}
+
+void Socket::closeHandle()
+{
+  mtx.lock();
+  if (socket_ > 0) {
+    epoll_.remove(*this);
+    if (::close(socket_) == -1) {
+      error("close",strerror(errno));
+    }
+    socket_ = 0;
+  }
+  mtx.unlock();
+}
+
+void Socket::attach(int socket, int events)
+{
+  mtx.lock();
+  socket_ = socket;
+  events_ = events;
+  mtx.unlock();
+}
+
 void Socket::disconnect() {
   mtx.lock();
   if (state_ == SocketState::CONNECTED) {  
@@ -174,6 +783,7 @@ void Socket::disconnected()
 {
   mtx.lock();
   if (state_ != SocketState::DISCONNECTED) {
+    epoll_.remove(*this);
     ::close(socket_);
     socket_ = 0;
     state_ = SocketState::DISCONNECTED;
@@ -186,6 +796,41 @@ void Socket::disconnected()
 
 /* DataSocket */
 
+const size_t DataSocket::MIN_READ_SIZE;
+const size_t DataSocket::MAX_READ_SIZE;
+const size_t DataSocket::FILE_CHUNK_SIZE;
+
+// Set in DataSocket::refs_ once destroy() has been called
+static const unsigned DESTROYED = 0x80000000U;
+// Set in DataSocket::refs_ once release() has been called, after which no reference can be taken
+static const unsigned RELEASED = 0x40000000U;
+
+// Keeps a DataSocket alive while a task that refers to it is queued or running. A reference to a 
+// socket that has already been released is empty.
+class DataSocket::Reference {
+  public:
+    Reference(DataSocket *socket) : socket_(socket->ref() ? socket : nullptr) {}
+    Reference(Reference &&other) : socket_(other.socket_) { other.socket_ = nullptr; }
+    ~Reference() { if (socket_) socket_->unref(); }
+    explicit operator bool() const { return socket_ != nullptr; }
+    DataSocket *operator->() const { return socket_; }
+  private:
+    DataSocket *socket_;
+};
+
+DataSocket::~DataSocket()
+{
+  // Release the blocks of zerocopy sends that have completed while the handle is still open
+  if (outputBuffer.pinned() > 0) {
+    readErrorQueue();
+  }
+  for (size_t i=0;i<files_.size();++i) {
+    if (files_[i].callback) {
+      files_[i].callback(false);
+    }
+  }
+}
+
 void DataSocket::disconnect()
 { 
   mtx.lock();
@@ -213,81 +858,664 @@ void DataSocket::disconnected()
 
 void DataSocket::readToInputBuffer()
 {
-  uint8_t buffer[256];
-  int size;
+  // Each read is offered readSize_ bytes. This doubles while reads fill the space and halves when 
+  // they use less than a quarter of it.
+  struct iovec iov[MAX_READ_SIZE / ByteBuffer::DEFAULT_BLOCK_SIZE + 1];
+  size_t size;
+  size_t space;
   do {
-    size = read_(&buffer[0],256);
-    for (int i=0;i<size;i++) {
-      inputBuffer.push_back(buffer[i]);
+    size_t count = inputBuffer.reserve(readSize_,iov,sizeof(iov) / sizeof(iov[0]));
+    space = 0;
+    for (size_t i=0;i<count;++i) {
+      space += iov[i].iov_len;
+    }
+    size = read_(iov,count);
+    inputBuffer.commit(size);
+    if (size >= readSize_) {
+      readSize_ = min(readSize_ * 2,MAX_READ_SIZE);
+    } else if ((size > 0) && (size < readSize_ / 4)) {
+      readSize_ = max(readSize_ / 2,MIN_READ_SIZE);
     }
-  } while (size > 0);
+    // A short read means a plaintext socket is empty. A level triggered epoll instance reports any data 
+    // that arrives later, so the read that would return EAGAIN can be skipped. SSL may hold decrypted
+    // data that epoll does not know about.
+  } while ((size > 0) && ((size == space) || ssl_ || epoll().edgeTriggered()));
 }
 
 void DataSocket::sendOutputBuffer()
 {
+  if (completion_) {
+    queueSend();
+    return;
+  }
   mtx.lock();
-  size_t size = outputBuffer.size();
-  if (size == 0) return;
-  uint8_t *buffer = (uint8_t*)malloc(size);
-  for (size_t i=0;i<size;i++) {
-    buffer[i] = outputBuffer.at(0);
-    outputBuffer.pop_front();
+  if (!hasOutput()) {
+    mtx.unlock();
+    return;
+  }
+  struct iovec iov[IOV_MAX];
+  vector<SendFileCallback> completed;
+  // sendfile() takes no flags, so TCP_CORK holds back the partial segments around a file region
+  bool tcpCork = !ssl_ && !files_.empty() && setCork(true);
+  // While corked, more of the batch follows whatever is sent now
+  int more = (corked_ > 0) ? MSG_MORE : 0;
+  bool complete;
+  do {
+    size_t limit = sendable();
+    if (limit == 0) {
+      // The data written before the first file region has been sent
+      complete = sendFileRegion(completed);
+      continue;
+    }
+    size_t count = outputBuffer.iovecs(iov,IOV_MAX,limit);
+    size_t size = 0;
+    for (size_t i=0;i<count;++i) {
+      size += iov[i].iov_len;
+    }
+    bool zerocopy = (zeroCopyThreshold_ > 0) && !ssl_ && (size >= zeroCopyThreshold_);
+    size_t res = write_(iov,count,more | (zerocopy ? MSG_ZEROCOPY : 0));
+    if (zerocopy && (res == 0) && (errno == ENOBUFS)) {
+      // The socket has reached its limit of pinned memory
+      zerocopy = false;
+      res = write_(iov,count,more);
+    }
+    if (zerocopy && (res > 0)) {
+      outputBuffer.pin(res);
+    }
+    outputBuffer.consume(res);
+    sent_ += res;
+    if (res > 0) {
+      // A send without MSG_MORE pushes everything that the kernel was holding back
+      morePending_ = (more != 0);
+    }
+    complete = (res == size);
+  } while (complete && hasOutput());
+  if (tcpCork) {
+    setCork(false);
+  }
+  if (!complete) {
+    // A partial write means the socket send buffer is full
+    writable_ = false;
+  }
+  canSend(!complete);
+  checkWatermarks();
+  for (size_t i=0;i<completed.size();++i) {
+    completed[i](true);
   }
-  size_t res = write_(buffer,size);
-  canSend(res!=size);
-  if (res != size) {
-    for (size_t i=res;i<size;i++) {
-      outputBuffer.push_front(buffer[i]);
+  mtx.unlock();
+}
+
+bool DataSocket::setCork(bool value)
+{
+  int enable = value ? 1 : 0;
+  return setsockopt(socket(),IPPROTO_TCP,TCP_CORK,&enable,sizeof(enable)) != -1;
+}
+
+void DataSocket::flushOutput()
+{
+  // A worker thread leaves the send to the EPoll thread
+  if (workers_) {
+    requestFlush();
+  } else if ((flushPolicy_ == FlushPolicy::END_OF_LOOP) && !completion_) {
+    if (epoll().inPoll()) {
+      markDirty();
+    } else {
+      requestFlush();
     }
+  } else if ((flushPolicy_ == FlushPolicy::WRITE_THROUGH) && writable_ && !completion_ && !epoll().edgeTriggered()) {
+    // Only the remainder waits for EPOLLOUT
+    sendOutputBuffer();
+  } else {
+    canSend(true);
+  }
+}
+
+void DataSocket::markDirty()
+{
+  // The dirty list holds a reference, which flushDirty() releases
+  if (!dirty_ && ref()) {
+    dirty_ = true;
+    epoll().dirty_.push_back(this);
+  }
+}
+
+void DataSocket::flushDirty()
+{
+  mtx.lock();
+  dirty_ = false;
+  if (state_ == SocketState::CONNECTED) {
+    sendOutputBuffer();
   }
-  free(buffer);
+  mtx.unlock();
+  unref();
+}
+
+void DataSocket::cork()
+{
+  mtx.lock();
+  ++corked_;
   mtx.unlock();
 }
 
+void DataSocket::uncork()
+{
+  mtx.lock();
+  if ((corked_ > 0) && (--corked_ == 0)) {
+    if (hasOutput()) {
+      flushOutput();
+    } else if (morePending_ && (state_ == SocketState::CONNECTED)) {
+      // Everything was sent with MSG_MORE, so the kernel may still hold back a partial segment. Clearing 
+      // TCP_CORK pushes it.
+      morePending_ = false;
+      setCork(false);
+    }
+  }
+  mtx.unlock();
+}
+
+size_t DataSocket::sendable() const
+{
+  if (files_.empty()) {
+    return outputBuffer.size();
+  } else {
+    return files_.front().mark - sent_;
+  }
+}
+
+bool DataSocket::sendFileRegion(vector<SendFileCallback> &completed)
+{
+  FileRegion &region = files_.front();
+  const char *failed = nullptr;
+  if (ssl_) {
+    // SSL has to encrypt the data in user space
+    uint8_t buffer[FILE_CHUNK_SIZE];
+    while (region.size > 0) {
+      ssize_t res = ::pread(region.fd,buffer,min(region.size,FILE_CHUNK_SIZE),region.offset);
+      if (res <= 0) {
+        failed = (res == -1) ? strerror(errno) : "Unexpected end of file";
+        break;
+      }
+      size_t written = ssl_->write(buffer,res);
+      region.offset += written;
+      region.size -= written;
+      if (written != (size_t)res) {
+        return false;
+      }
+    }
+  } else {
+    while (region.size > 0) {
+      ssize_t res = ::sendfile(socket(),region.fd,&region.offset,min<size_t>(region.size,0x7ffff000));
+      if (res > 0) {
+        region.size -= res;
+      } else if ((res == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+        return false;
+      } else {
+        failed = (res == -1) ? strerror(errno) : "Unexpected end of file";
+        break;
+      }
+    }
+  }
+  if (failed) {
+    error("sendfile",failed);
+    if (region.callback) {
+      region.callback(false);
+    }
+  } else if (region.callback) {
+    completed.push_back(std::move(region.callback));
+  }
+  files_.pop_front();
+  return true;
+}
+
 void DataSocket::canSend(bool value) 
 {
-  int events = EPOLLIN | EPOLLRDHUP;
+  if (completion_) {
+    if (value) {
+      queueSend();
+    }
+    return;
+  }
+  if (epoll().edgeTriggered()) {
+    if (value && writable_) {
+      sendOutputBuffer();
+    }
+    return;
+  }
+  int events = readPaused_ ? EPOLLRDHUP : (EPOLLIN | EPOLLRDHUP);
   if (value)
     events |= EPOLLOUT;
   setEvents(events);
 }
 
+size_t DataSocket::buffered() const
+{
+  size_t result = outputBuffer.size();
+  for (size_t i=0;i<files_.size();++i) {
+    result += files_[i].size;
+  }
+  return result;
+}
+
+size_t DataSocket::bufferedAmount()
+{
+  mtx.lock();
+  size_t result = buffered();
+  mtx.unlock();
+  return result;
+}
+
+void DataSocket::setWatermarks(size_t high, size_t low)
+{
+  mtx.lock();
+  highWatermark_ = high;
+  lowWatermark_ = min(low,high);
+  checkWatermarks();
+  mtx.unlock();
+}
+
+void DataSocket::checkWatermarks()
+{
+  // Called after every write and send with mtx held, so the amount is only counted when it is needed
+  if ((highWatermark_ == 0) && !writeBlocked_) {
+    return;
+  }
+  size_t amount = buffered();
+  if (!writeBlocked_) {
+    if (amount > highWatermark_) {
+      writeBlocked_ = true;
+      if (pauseOnWriteBlocked_) {
+        pauseReading(true);
+      }
+      onWriteBlocked();
+    }
+  } else if ((highWatermark_ == 0) || (amount <= lowWatermark_)) {
+    writeBlocked_ = false;
+    if (pauseOnWriteBlocked_) {
+      pauseReading(false);
+    }
+    onWriteDrained();
+  }
+}
+
+void DataSocket::pauseReading(bool paused)
+{
+  // The watermark callbacks of a sink call this on its source with the mutex of the sink held, so the 
+  // mutex of this socket is only taken by a task on the polling thread. Taking it here could deadlock
+  // against the source writing to the sink.
+  if (readPaused_.exchange(paused) != paused) {
+    epoll().post([ref = Reference(this)]{ if (ref) ref->updateReading(); });
+  }
+}
+
+void DataSocket::updateReading()
+{
+  bool resume = false;
+  mtx.lock();
+  if (!completion_ && (state_ == SocketState::CONNECTED)) {
+    if (!epoll().edgeTriggered()) {
+      canSend(hasOutput());
+    }
+    // An edge triggered socket is not notified again about data that arrived while it was paused, 
+    // and SSL may hold data that was decrypted before the pause
+    if (!readPaused_ && (readPending_ || ssl_)) {
+      readPending_ = false;
+      resume = true;
+    }
+  }
+  mtx.unlock();
+  if (resume) {
+    DataSocket::handleEvents(EPOLLIN);
+  }
+}
+
 void DataSocket::handleEvents(uint32_t events)
 {
-  if (state_ == SocketState::CONNECTED) {
-    if (events & EPOLLRDHUP) {
+  if (lingering_) {
+    linger();
+    return;
+  }
+  // dataAvailable() may destroy the socket, which is then freed when the dispatch returns
+  Reference ref(this);
+  if (ref && (state_ == SocketState::CONNECTED)) {
+    if (!ssl_ && (epoll().backend() == EPollBackend::IO_URING)) {
+      startCompletions();
+    } else if (events & EPOLLRDHUP) {
       disconnected();
     } else {
-      if (events & EPOLLIN) {
+      if (events & EPOLLERR) {
+        mtx.lock();
+        readErrorQueue();
+        mtx.unlock();
+      }
+      if ((events & EPOLLIN) && readPaused_) {
+        mtx.lock();
+        readPending_ = true;
+        mtx.unlock();
+      } else if (events & EPOLLIN) {
         mtx.lock();
         readToInputBuffer();
-        dataAvailable();
-        if (outputBuffer.size() > 0U) {
-          sendOutputBuffer();
-          canSend(outputBuffer.size() > 0U);
+        if (workers_) {
+          schedule();
         } else {
-          canSend(false);  
+          dataAvailable();
+          if (hasOutput() && (corked_ == 0) && !dirty_) {
+            sendOutputBuffer();
+            canSend(hasOutput());
+          } else {
+            canSend(false);  
+          }
         }
         mtx.unlock();
       }
       if (events & EPOLLOUT) {
         mtx.lock();
+        writable_ = true;
         sendOutputBuffer();
-        canSend(outputBuffer.size() > 0U);
+        canSend(hasOutput());
         mtx.unlock();
       }
     }
   }
 }
 
-size_t DataSocket::read_(void *buffer, size_t size)
+void DataSocket::startCompletions()
+{
+  // Any data already waiting will be delivered by the first receive completion
+  mtx.lock();
+  completion_ = true;
+  setEvents(0);
+  if (!submit(IOOperation::RECV)) {
+    error("DataSocket","Unable to submit receive");
+  }
+  mtx.unlock();
+  queueSend();
+}
+
+void DataSocket::queueSend()
+{
+  mtx.lock();
+  vector<SendFileCallback> completed;
+  while (!sending_ && hasOutput()) {
+    size_t size = sendable();
+    vector<uint8_t> buffer;
+    if (size > 0) {
+      buffer.resize(size);
+      outputBuffer.read(buffer.data(),size);
+      sent_ += size;
+    } else {
+      // The ring sends from memory, so file regions are read a chunk at a time
+      FileRegion &region = files_.front();
+      buffer.resize(min(region.size,FILE_CHUNK_SIZE));
+      ssize_t res = ::pread(region.fd,buffer.data(),buffer.size(),region.offset);
+      if (res <= 0) {
+        error("pread",(res == -1) ? strerror(errno) : "Unexpected end of file");
+        if (region.callback) {
+          region.callback(false);
+        }
+        files_.pop_front();
+        continue;
+      }
+      buffer.resize(res);
+      region.offset += res;
+      region.size -= res;
+      if (region.size == 0) {
+        if (region.callback) {
+          completed.push_back(std::move(region.callback));
+        }
+        files_.pop_front();
+      }
+    }
+    sending_ = submitSend(std::move(buffer));
+  }
+  checkWatermarks();
+  for (size_t i=0;i<completed.size();++i) {
+    completed[i](true);
+  }
+  mtx.unlock();
+}
+
+void DataSocket::handleCompletion(IOOperation op, int result, bool more, const uint8_t *data)
+{
+  if (state_ != SocketState::CONNECTED) {
+    return;
+  }
+  Reference ref(this);
+  if (!ref) {
+    return;
+  }
+  if (op == IOOperation::RECV) {
+    if (result > 0) {
+      mtx.lock();
+      inputBuffer.append(data,result);
+      if (workers_) {
+        schedule();
+      } else {
+        dataAvailable();
+      }
+      mtx.unlock();
+    } else if (result == 0) {
+      disconnected();
+      return;
+    } else if ((result != -ENOBUFS) && (result != -ECANCELED)) {
+      error("recv",strerror(-result));
+      disconnected();
+      return;
+    }
+    // ENOBUFS means that every provided buffer is waiting to be recycled. Completions already in the
+    // queue recycle them before the new receive is submitted.
+    if (!more && (state_ == SocketState::CONNECTED) && !submit(IOOperation::RECV)) {
+      error("DataSocket","Unable to submit receive");
+      disconnected();
+    }
+  } else if (op == IOOperation::SEND) {
+    mtx.lock();
+    sending_ = false;
+    mtx.unlock();
+    if (result < 0) {
+      if (result != -ECANCELED) {
+        error("send",strerror(-result));
+        disconnected();
+      }
+    } else {
+      queueSend();
+    }
+  }
+}
+
+void DataSocket::schedule()
+{
+  // Only the first notification since the worker last caught up queues the socket
+  if (work_.fetch_add(1) == 0) {
+    workers_->submit([ref = Reference(this)]{ if (ref) ref->work(); });
+  }
+}
+
+void DataSocket::work()
+{
+  unsigned count;
+  do {
+    count = work_.load();
+    if (state_ == SocketState::CONNECTED) {
+      dataAvailable();
+    }
+  } while (work_.fetch_sub(count) != count);
+}
+
+void DataSocket::requestFlush()
+{
+  if (!flushPending_.exchange(true)) {
+    epoll().post([ref = Reference(this)]{ if (ref) ref->flush(); });
+  }
+}
+
+void DataSocket::flush()
 {
+  flushPending_ = false;
+  mtx.lock();
   if (state_ == SocketState::CONNECTED) {
-    size_t result;
+    sendOutputBuffer();
+  }
+  mtx.unlock();
+}
+
+bool DataSocket::ref()
+{
+  unsigned refs = refs_.load();
+  do {
+    if (refs & RELEASED) {
+      return false;
+    }
+  } while (!refs_.compare_exchange_weak(refs,refs + 1));
+  return true;
+}
+
+void DataSocket::unref()
+{
+  if (refs_.fetch_sub(1) == (DESTROYED | 1)) {
+    tryRelease();
+  }
+}
+
+void DataSocket::destroy()
+{
+  // No event is dispatched to the socket once it has been removed, but one may already be running
+  epoll().remove(*this);
+  if ((refs_.fetch_or(DESTROYED) & ~DESTROYED) == 0) {
+    tryRelease();
+  }
+}
+
+void DataSocket::tryRelease()
+{
+  // A reference taken after the count reached zero makes the exchange fail, and its unref() releases 
+  // the socket instead. Once RELEASED is set, no further reference can be taken.
+  unsigned refs = DESTROYED;
+  if (refs_.compare_exchange_strong(refs,DESTROYED | RELEASED)) {
+    release();
+  }
+}
+
+void DataSocket::release()
+{
+  // The polling thread does not hold a reference while it dispatches an event, so a socket destroyed 
+  // on another thread is freed by a task that runs after the dispatch has returned
+  if (epoll().inPoll()) {
+    finish();
+  } else {
+    epoll().post([this]{ finish(); });
+  }
+}
+
+void DataSocket::finish()
+{
+  // The kernel still reads the blocks of unfinished zerocopy sends, so the socket stays open until 
+  // their completions have been read from its error queue. Only the error queue is watched, and
+  // EPOLLET reports each new notification once.
+  mtx.lock();
+  readErrorQueue();
+  if ((outputBuffer.pinned() > 0) && (socket() > 0)) {
+    lingering_ = true;
+    setEvents(EPOLLET);
+    if (enableEvents()) {
+      mtx.unlock();
+      lingerStarted();
+      return;
+    }
+    lingering_ = false;
+  }
+  mtx.unlock();
+  dispose();
+}
+
+void DataSocket::linger()
+{
+  mtx.lock();
+  readErrorQueue();
+  bool done = (outputBuffer.pinned() == 0);
+  if (done) {
+    lingering_ = false;
+    epoll().remove(*this);
+  }
+  mtx.unlock();
+  if (done) {
+    dispose();
+  }
+}
+
+void DataSocket::stopLingering()
+{
+  // An abortive close discards the data still queued in the kernel, so the pinned blocks are no longer
+  // sent and can be released
+  mtx.lock();
+  bool lingering = lingering_;
+  if (lingering) {
+    lingering_ = false;
+    struct linger abort = {1,0};
+    setsockopt(socket(),SOL_SOCKET,SO_LINGER,&abort,sizeof(abort));
+    closeHandle();
+    outputBuffer.unpin(0,UINT32_MAX);
+  }
+  mtx.unlock();
+  if (lingering) {
+    dispose();
+  }
+}
+
+void DataSocket::dispose()
+{
+  delete this;
+}
+
+void DataSocket::recycle()
+{
+  mtx.lock();
+  closeHandle();
+  for (size_t i=0;i<files_.size();++i) {
+    if (files_[i].callback) {
+      files_[i].callback(false);
+    }
+  }
+  files_.clear();
+  // Cleared buffers return their blocks to the pool of the EPoll instance
+  inputBuffer.clear();
+  outputBuffer.clear();
+  if (ssl_) {
+    ssl_->clear();
+  }
+  sent_ = 0;
+  corked_ = 0;
+  morePending_ = false;
+  readSize_ = MIN_READ_SIZE * 2;
+  writeBlocked_ = false;
+  readPaused_ = false;
+  readPending_ = false;
+  zeroCopyCopied_ = 0;
+  completion_ = false;
+  sending_ = false;
+  writable_ = true;
+  lingering_ = false;
+  work_ = 0;
+  flushPending_ = false;
+  refs_ = 0;
+  state_ = SocketState::UNCONNECTED;
+  mtx.unlock();
+}
+
+size_t DataSocket::read_(const struct iovec *iov, size_t count)
+{
+  if (state_ == SocketState::CONNECTED) {
+    size_t result = 0;
     if (ssl_) {
-      result = ssl_->read(buffer,size);
+      for (size_t i=0;i<count;++i) {
+        size_t res = ssl_->read(iov[i].iov_base,iov[i].iov_len);
+        result += res;
+        if (res != iov[i].iov_len) {
+          break;
+        }
+      }
     } else {
-      result = ::recv(socket(),buffer,size,0);
+      ssize_t res = ::readv(socket(),iov,count);
+      result = (res > 0) ? res : 0;
     }
     return result;
   } else {
@@ -295,14 +1523,25 @@ size_t DataSocket::read_(void *buffer, size_t size)
   }
 }
 
-size_t DataSocket::write_(const void *buffer, size_t size)
+size_t DataSocket::write_(const struct iovec *iov, size_t count, int flags)
 {
   if (state_ == SocketState::CONNECTED) {
-    size_t result;
+    size_t result = 0;
     if (ssl_) {
-      result = ssl_->write(buffer,size);
+      for (size_t i=0;i<count;++i) {
+        size_t res = ssl_->write(iov[i].iov_base,iov[i].iov_len);
+        result += res;
+        if (res != iov[i].iov_len) {
+          break;
+        }
+      }
     } else {
-      result = ::send(socket(),buffer,size,MSG_NOSIGNAL);
+      struct msghdr msg;
+      memset(&msg,0,sizeof(msg));
+      msg.msg_iov = const_cast<struct iovec*>(iov);
+      msg.msg_iovlen = count;
+      ssize_t res = ::sendmsg(socket(),&msg,MSG_NOSIGNAL | flags);
+      result = (res > 0) ? res : 0;
     }
     return result;
   } else {
@@ -310,37 +1549,170 @@ size_t DataSocket::write_(const void *buffer, size_t size)
   }
 }
 
+bool DataSocket::setZeroCopy(size_t threshold)
+{
+  bool result = true;
+  mtx.lock();
+  if (threshold > 0) {
+    int enable = 1;
+    if (setsockopt(socket(),SOL_SOCKET,SO_ZEROCOPY,&enable,sizeof(enable)) == -1) {
+      error("setsockopt","Could not set socket option SO_ZEROCOPY: " + string(strerror(errno)));
+      threshold = 0;
+      result = false;
+    }
+  }
+  zeroCopyThreshold_ = threshold;
+  mtx.unlock();
+  return result;
+}
+
+void DataSocket::readErrorQueue()
+{
+  if ((zeroCopyThreshold_ == 0) && (outputBuffer.pinned() == 0)) {
+    return;
+  }
+  // Each notification covers a range of zerocopy sends, numbered in the order they were made
+  uint8_t control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+  struct msghdr msg;
+  while (true) {
+    memset(&msg,0,sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(socket(),&msg,MSG_ERRQUEUE) == -1) {
+      break;
+    }
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);cmsg;cmsg = CMSG_NXTHDR(&msg,cmsg)) {
+      if (((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) || 
+          ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR))) {
+        struct sock_extended_err *err = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cmsg));
+        if ((err->ee_errno == 0) && (err->ee_origin == SO_EE_ORIGIN_ZEROCOPY)) {
+          outputBuffer.unpin(err->ee_info,err->ee_data);
+          if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+            zeroCopyCopied_ += err->ee_data - err->ee_info + 1;
+          }
+        }
+      }
+    }
+  }
+}
+
 size_t DataSocket::read(void *buffer, size_t size)
 {
   size_t result = 0;
   if (size) {
     mtx.lock();
-    result = max<size_t>(size,inputBuffer.size());
-    if (result > 0) {
-      for (size_t i=0;i<result;++i) {
-        ((uint8_t*)buffer)[i] = inputBuffer.at(0);
-        inputBuffer.pop_front();
-      }
-    }
+    result = inputBuffer.read(buffer,size);
     mtx.unlock();
   }
   return result;
 }
 
+size_t DataSocket::peek(void *buffer, size_t size, size_t offset)
+{
+  size_t result = 0;
+  if (size) {
+    mtx.lock();
+    result = inputBuffer.peek(buffer,size,offset);
+    mtx.unlock();
+  }
+  return result;
+}
+
+size_t DataSocket::find(uint8_t byte, size_t offset)
+{
+  mtx.lock();
+  size_t result = inputBuffer.find(byte,offset);
+  mtx.unlock();
+  return result;
+}
+
+const uint8_t *DataSocket::view(size_t size)
+{
+  mtx.lock();
+  const uint8_t *result = inputBuffer.contiguous(size);
+  mtx.unlock();
+  return result;
+}
+
+size_t DataSocket::view(struct iovec *iov, size_t count, size_t limit)
+{
+  mtx.lock();
+  size_t result = inputBuffer.iovecs(iov,count,limit);
+  mtx.unlock();
+  return result;
+}
+
+size_t DataSocket::consume(size_t size)
+{
+  mtx.lock();
+  size_t result = inputBuffer.consume(size);
+  mtx.unlock();
+  return result;
+}
+
 size_t DataSocket::write(const void *buffer, size_t size)
 {
   size_t result = 0U;
   if (size) {
     mtx.lock();
+    size_t before = outputBuffer.size();
     try {
-      for (size_t i=0;i<size;++i) {
-        outputBuffer.push_back(((uint8_t*)buffer)[i]);
-        ++result;
+      outputBuffer.append(buffer,size);
+      result = size;
+      if (corked_ == 0) {
+        flushOutput();
       }
-      canSend(true);
+      checkWatermarks();
     } catch (const std::bad_alloc&) {
-      mtx.unlock();
+      // append() keeps the blocks it filled before the allocation failed
+      result = outputBuffer.size() - before;
     }
+    mtx.unlock();
+  }
+  return result;
+}
+
+bool DataSocket::sendFile(int fd, off_t offset, size_t size, SendFileCallback callback)
+{
+  bool result = false;
+  if (size) {
+    mtx.lock();
+    if (state_ == SocketState::CONNECTED) {
+      FileRegion region;
+      region.fd = fd;
+      region.offset = offset;
+      region.size = size;
+      region.mark = sent_ + outputBuffer.size();
+      region.callback = std::move(callback);
+      files_.push_back(std::move(region));
+      result = true;
+      if (corked_ == 0) {
+        flushOutput();
+      }
+      checkWatermarks();
+    }
+    mtx.unlock();
+  }
+  return result;
+}
+
+size_t DataSocket::write(const SharedBuffer &buffer)
+{
+  size_t result = 0U;
+  if (!buffer.empty()) {
+    mtx.lock();
+    size_t before = outputBuffer.size();
+    try {
+      outputBuffer.append(buffer);
+      result = buffer.size();
+      if (corked_ == 0) {
+        flushOutput();
+      }
+      checkWatermarks();
+    } catch (const std::bad_alloc&) {
+      result = outputBuffer.size() - before;
+    }
+    mtx.unlock();
   }
   return result;
 }
@@ -631,6 +631,7 @@ size_t SSL::write(const void *buffer, size_t size)
 
 void SSL::clear()
 {
+  subjectName_.clear();
   int res = SSL_clear(ssl_);
   if ( res != 1) {
     unsigned long ssl_err = ERR_get_error();
@@ -0,0 +1,56 @@
+#include "tcptask.h"
+
+namespace tcp {
+
+using namespace std;
+
+TaskQueue::TaskQueue() : head_(&stub_), tail_(&stub_)
+{
+}
+
+TaskQueue::~TaskQueue()
+{
+  Task *task;
+  while ((task = pop()) != nullptr) {
+    delete task;
+  }
+}
+
+void TaskQueue::push(Task *task)
+{
+  task->next_.store(nullptr,memory_order_relaxed);
+  Task *prev = head_.exchange(task,memory_order_acq_rel);
+  prev->next_.store(task,memory_order_release);
+}
+
+Task *TaskQueue::pop()
+{
+  Task *tail = tail_;
+  Task *next = tail->next_.load(memory_order_acquire);
+  if (tail == &stub_) {
+    if (next == nullptr) {
+      return nullptr;
+    }
+    tail_ = next;
+    tail = next;
+    next = next->next_.load(memory_order_acquire);
+  }
+  if (next != nullptr) {
+    tail_ = next;
+    return tail;
+  }
+  if (tail != head_.load(memory_order_acquire)) {
+    // A producer has swapped the head but not linked its task yet
+    return nullptr;
+  }
+  // tail is the last task. Put the stub behind it so that tail can be unlinked.
+  push(&stub_);
+  next = tail->next_.load(memory_order_acquire);
+  if (next != nullptr) {
+    tail_ = next;
+    return tail;
+  }
+  return nullptr;
+}
+
+} // namespace tcp
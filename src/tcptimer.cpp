@@ -0,0 +1,231 @@
+#include "tcptimer.h"
+#include <string.h>
+
+namespace tcp {
+
+using namespace std;
+
+TimerWheel::TimerWheel(uint64_t now) : current_(now)
+{
+  for (unsigned level=0;level<LEVELS;++level) {
+    for (unsigned slot=0;slot<SLOTS;++slot) {
+      heads_[level][slot] = NIL;
+    }
+  }
+  memset(occupied_,0,sizeof(occupied_));
+}
+
+TimerId TimerWheel::add(uint64_t expiry, uint64_t interval, TimerCallback callback)
+{
+  uint32_t index;
+  if (free_.empty()) {
+    index = nodes_.size();
+    nodes_.push_back(Node());
+  } else {
+    index = free_.back();
+    free_.pop_back();
+  }
+  Node &node = nodes_[index];
+  node.expiry = expiry;
+  node.interval = interval;
+  node.callback = make_shared<TimerCallback>(std::move(callback));
+  node.active = true;
+  place(index);
+  ++count_;
+  return ((uint64_t)node.generation << 32) | (index + 1);
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+  uint32_t index = (uint32_t)id - 1;
+  if ((index >= nodes_.size()) || !nodes_[index].active || (nodes_[index].generation != (id >> 32))) {
+    return false;
+  }
+  unlink(index);
+  release(index);
+  return true;
+}
+
+void TimerWheel::expire(uint64_t now, vector<shared_ptr<TimerCallback>> &expired)
+{
+  while (current_ <= now) {
+    if (count_ == 0) {
+      current_ = now + 1;
+      return;
+    }
+    uint64_t tick = current_;
+    unsigned slot = tick & MASK;
+    // Advance before handling the slot so that timers added for this tick go into the next one
+    advance(tick + 1);
+    uint32_t index = detach(0,slot);
+    while (index != NIL) {
+      Node &node = nodes_[index];
+      uint32_t next = node.next;
+      if (node.expiry > tick) {
+        // Clamped to the top of the wheel when it was added
+        place(index);
+      } else {
+        expired.push_back(node.callback);
+        if (node.interval) {
+          node.expiry += node.interval;
+          if (node.expiry <= now) {
+            node.expiry = now + node.interval;
+          }
+          place(index);
+        } else {
+          release(index);
+        }
+      }
+      index = next;
+    }
+    // Skip to the next occupied slot in this revolution of the first level, or to the point where it wraps
+    if ((count_ != 0) && ((current_ & MASK) != 0)) {
+      int found = findSlot(0,current_ & MASK,SLOTS);
+      uint64_t target = (found < 0) ? ((current_ | MASK) + 1) : ((current_ & ~MASK) + found);
+      advance(min(target,now + 1));
+    }
+  }
+}
+
+uint64_t TimerWheel::next() const
+{
+  if (count_ == 0) {
+    return NEVER;
+  }
+  uint64_t result = NEVER;
+  unsigned position = current_ & MASK;
+  int found = findSlot(0,position,SLOTS);
+  if (found >= 0) {
+    return (current_ & ~MASK) + found;
+  }
+  found = findSlot(0,0,position);
+  if (found >= 0) {
+    result = (current_ | MASK) + 1 + found;
+  }
+  for (unsigned level=1;level<LEVELS;++level) {
+    unsigned shift = level * BITS;
+    position = (current_ >> shift) & MASK;
+    found = findSlot(level,position + 1,SLOTS);
+    uint64_t distance;
+    if (found >= 0) {
+      distance = found - position;
+    } else {
+      // A slot at or before the current position is not cascaded until the level wraps
+      found = findSlot(level,0,position + 1);
+      if (found < 0) {
+        continue;
+      }
+      distance = SLOTS - position + found;
+    }
+    result = min(result,((current_ >> shift) + distance) << shift);
+  }
+  return result;
+}
+
+void TimerWheel::place(uint32_t index)
+{
+  Node &node = nodes_[index];
+  uint64_t delta = (node.expiry > current_) ? (node.expiry - current_) : 0;
+  uint64_t limit = (1ULL << (LEVELS * BITS)) - 1;
+  uint64_t expiry = (delta > limit) ? (current_ + limit) : (current_ + delta);
+  if (delta > limit) {
+    delta = limit;
+  }
+  unsigned level = 0;
+  while ((level < LEVELS - 1) && (delta >= (1ULL << ((level + 1) * BITS)))) {
+    ++level;
+  }
+  link(index,level,(expiry >> (level * BITS)) & MASK);
+}
+
+void TimerWheel::link(uint32_t index, unsigned level, unsigned slot)
+{
+  Node &node = nodes_[index];
+  node.slot = level * SLOTS + slot;
+  node.prev = NIL;
+  node.next = heads_[level][slot];
+  if (node.next != NIL) {
+    nodes_[node.next].prev = index;
+  }
+  heads_[level][slot] = index;
+  occupied_[level][slot / 64] |= (1ULL << (slot % 64));
+}
+
+void TimerWheel::unlink(uint32_t index)
+{
+  Node &node = nodes_[index];
+  unsigned level = node.slot / SLOTS;
+  unsigned slot = node.slot % SLOTS;
+  if (node.prev != NIL) {
+    nodes_[node.prev].next = node.next;
+  } else {
+    heads_[level][slot] = node.next;
+  }
+  if (node.next != NIL) {
+    nodes_[node.next].prev = node.prev;
+  }
+  if (heads_[level][slot] == NIL) {
+    occupied_[level][slot / 64] &= ~(1ULL << (slot % 64));
+  }
+  node.prev = NIL;
+  node.next = NIL;
+}
+
+void TimerWheel::release(uint32_t index)
+{
+  Node &node = nodes_[index];
+  node.callback.reset();
+  node.active = false;
+  ++node.generation;
+  free_.push_back(index);
+  --count_;
+}
+
+uint32_t TimerWheel::detach(unsigned level, unsigned slot)
+{
+  uint32_t result = heads_[level][slot];
+  heads_[level][slot] = NIL;
+  occupied_[level][slot / 64] &= ~(1ULL << (slot % 64));
+  return result;
+}
+
+void TimerWheel::cascade()
+{
+  // Called when the first level wraps. Each upper level is cascaded in turn until one has not wrapped.
+  for (unsigned level=1;level<LEVELS;++level) {
+    unsigned slot = (current_ >> (level * BITS)) & MASK;
+    uint32_t index = detach(level,slot);
+    while (index != NIL) {
+      uint32_t next = nodes_[index].next;
+      place(index);
+      index = next;
+    }
+    if (slot != 0) {
+      break;
+    }
+  }
+}
+
+void TimerWheel::advance(uint64_t tick)
+{
+  // Never moves past a point where the first level wraps without cascading
+  current_ = tick;
+  if ((current_ & MASK) == 0) {
+    cascade();
+  }
+}
+
+int TimerWheel::findSlot(unsigned level, unsigned from, unsigned to) const
+{
+  while (from < to) {
+    uint64_t word = occupied_[level][from / 64] >> (from % 64);
+    if (word) {
+      unsigned result = from + __builtin_ctzll(word);
+      return (result < to) ? result : -1;
+    }
+    from = (from / 64 + 1) * 64;
+  }
+  return -1;
+}
+
+} // namespace tcp
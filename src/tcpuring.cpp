@@ -0,0 +1,364 @@
+#include "tcpuring.h"
+#include "tcpsocket.h"
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+namespace tcp {
+
+using namespace std;
+
+Ring::Ring(unsigned entries, unsigned buffers, unsigned bufferSize) : bufferCount_(buffers), bufferSize_(bufferSize)
+{
+  struct io_uring_params params;
+  memset(&params,0,sizeof(params));
+  params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+  fd_ = syscall(__NR_io_uring_setup,entries,&params);
+  if ((fd_ == -1) && (errno == EINVAL)) {
+    // Older kernels do not support the setup flags
+    memset(&params,0,sizeof(params));
+    fd_ = syscall(__NR_io_uring_setup,entries,&params);
+  }
+  if (fd_ == -1) {
+    error("io_uring_setup",strerror(errno));
+    return;
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) {
+    error("io_uring_setup","Kernel does not support the required io_uring features");
+    ::close(fd_);
+    fd_ = -1;
+    return;
+  }
+
+  sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    sqRingSize_ = max<size_t>(sqRingSize_,cqRingSize_);
+    cqRingSize_ = sqRingSize_;
+  }
+  sqRing_ = mmap(0,sqRingSize_,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,fd_,IORING_OFF_SQ_RING);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cqRing_ = sqRing_;
+  } else {
+    cqRing_ = mmap(0,cqRingSize_,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,fd_,IORING_OFF_CQ_RING);
+  }
+  sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = (io_uring_sqe*)mmap(0,sqesSize_,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,fd_,IORING_OFF_SQES);
+  if ((sqRing_ == MAP_FAILED) || (cqRing_ == MAP_FAILED) || (sqes_ == MAP_FAILED)) {
+    error("mmap",strerror(errno));
+    ::close(fd_);
+    fd_ = -1;
+    return;
+  }
+
+  uint8_t *sq = (uint8_t*)sqRing_;
+  uint8_t *cq = (uint8_t*)cqRing_;
+  sqHead_ = (unsigned*)(sq + params.sq_off.head);
+  sqTailPtr_ = (unsigned*)(sq + params.sq_off.tail);
+  sqMask_ = (unsigned*)(sq + params.sq_off.ring_mask);
+  sqArray_ = (unsigned*)(sq + params.sq_off.array);
+  sqEntries_ = params.sq_entries;
+  sqTail_ = *sqTailPtr_;
+  cqHead_ = (unsigned*)(cq + params.cq_off.head);
+  cqTail_ = (unsigned*)(cq + params.cq_off.tail);
+  cqMask_ = (unsigned*)(cq + params.cq_off.ring_mask);
+  cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  // Register a ring of provided buffers for multishot receives. Receives cannot be made without it,
+  // so the ring is marked invalid if this fails.
+  bufRing_ = (io_uring_buf_ring*)mmap(0,bufferCount_ * sizeof(struct io_uring_buf),PROT_READ | PROT_WRITE,MAP_ANONYMOUS | MAP_PRIVATE,-1,0);
+  if (bufRing_ == MAP_FAILED) {
+    error("mmap",strerror(errno));
+    bufRing_ = nullptr;
+    ::close(fd_);
+    fd_ = -1;
+    return;
+  }
+  buffers_ = (uint8_t*)mmap(0,(size_t)bufferCount_ * bufferSize_,PROT_READ | PROT_WRITE,MAP_ANONYMOUS | MAP_PRIVATE,-1,0);
+  if (buffers_ == MAP_FAILED) {
+    error("mmap",strerror(errno));
+    buffers_ = nullptr;
+    ::close(fd_);
+    fd_ = -1;
+    return;
+  }
+  struct io_uring_buf_reg reg;
+  memset(&reg,0,sizeof(reg));
+  reg.ring_addr = (uint64_t)bufRing_;
+  reg.ring_entries = bufferCount_;
+  reg.bgid = 0;
+  if (syscall(__NR_io_uring_register,fd_,IORING_REGISTER_PBUF_RING,&reg,1) == -1) {
+    error("io_uring_register",strerror(errno));
+    ::close(fd_);
+    fd_ = -1;
+    return;
+  }
+  for (unsigned i=0;i<bufferCount_;++i) {
+    recycle(i);
+  }
+}
+
+Ring::~Ring()
+{
+  if (fd_ != -1) {
+    ::close(fd_);
+  }
+  if (sqes_ && (sqes_ != MAP_FAILED)) {
+    munmap(sqes_,sqesSize_);
+  }
+  if (cqRing_ && (cqRing_ != MAP_FAILED) && (cqRing_ != sqRing_)) {
+    munmap(cqRing_,cqRingSize_);
+  }
+  if (sqRing_ && (sqRing_ != MAP_FAILED)) {
+    munmap(sqRing_,sqRingSize_);
+  }
+  if (bufRing_) {
+    munmap(bufRing_,bufferCount_ * sizeof(struct io_uring_buf));
+  }
+  if (buffers_) {
+    munmap(buffers_,(size_t)bufferCount_ * bufferSize_);
+  }
+}
+
+int Ring::enter(unsigned submit, unsigned complete, unsigned flags, void *arg)
+{
+  return syscall(__NR_io_uring_enter,fd_,submit,complete,flags,arg,arg ? sizeof(struct io_uring_getevents_arg) : 0);
+}
+
+unsigned Ring::queued() const
+{
+  return sqTail_ - __atomic_load_n(sqHead_,__ATOMIC_ACQUIRE);
+}
+
+void Ring::submit()
+{
+  // The count comes from the head of the kernel rather than from what this thread queued, so a 
+  // submission made by wait() at the same time cannot leave the newest requests behind. The kernel 
+  // serializes the two calls and submits no more than is queued.
+  if (enter(queued(),0,0,nullptr) == -1) {
+    error("io_uring_enter",strerror(errno));
+  }
+}
+
+io_uring_sqe *Ring::getSQE()
+{
+  unsigned head = __atomic_load_n(sqHead_,__ATOMIC_ACQUIRE);
+  if (sqTail_ - head >= sqEntries_) {
+    // The submission queue is full. Submit what is queued to make room.
+    submit();
+    head = __atomic_load_n(sqHead_,__ATOMIC_ACQUIRE);
+    if (sqTail_ - head >= sqEntries_) {
+      return nullptr;
+    }
+  }
+  unsigned index = sqTail_ & *sqMask_;
+  io_uring_sqe *sqe = &sqes_[index];
+  memset(sqe,0,sizeof(struct io_uring_sqe));
+  sqArray_[index] = index;
+  return sqe;
+}
+
+void Ring::push()
+{
+  ++sqTail_;
+  __atomic_store_n(sqTailPtr_,sqTail_,__ATOMIC_RELEASE);
+}
+
+bool Ring::pollAdd(int fd, uint32_t events, uint64_t data)
+{
+  mtx.lock();
+  io_uring_sqe *sqe = getSQE();
+  if (sqe) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = data;
+    push();
+  }
+  mtx.unlock();
+  return sqe != nullptr;
+}
+
+bool Ring::pollRemove(uint64_t target)
+{
+  mtx.lock();
+  io_uring_sqe *sqe = getSQE();
+  if (sqe) {
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = 0;
+    push();
+  }
+  mtx.unlock();
+  return sqe != nullptr;
+}
+
+bool Ring::accept(int fd, uint64_t data)
+{
+  mtx.lock();
+  io_uring_sqe *sqe = getSQE();
+  if (sqe) {
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = data;
+    push();
+  }
+  mtx.unlock();
+  return sqe != nullptr;
+}
+
+bool Ring::recv(int fd, uint64_t data)
+{
+  mtx.lock();
+  io_uring_sqe *sqe = getSQE();
+  if (sqe) {
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = data;
+    push();
+  }
+  mtx.unlock();
+  return sqe != nullptr;
+}
+
+bool Ring::prepareSend(int fd, const uint8_t *data, size_t size, uint64_t user_data)
+{
+  io_uring_sqe *sqe = getSQE();
+  if (!sqe) return false;
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)data;
+  sqe->len = size;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+  push();
+  return true;
+}
+
+bool Ring::send(int fd, vector<uint8_t> &&buffer, uint64_t data)
+{
+  mtx.lock();
+  Send &send = sends_[data];
+  send.buffer = std::move(buffer);
+  send.offset = 0;
+  send.fd = fd;
+  bool result = prepareSend(fd,send.buffer.data(),send.buffer.size(),data);
+  if (!result) {
+    sends_.erase(data);
+  }
+  mtx.unlock();
+  return result;
+}
+
+bool Ring::sent(uint64_t data, int result)
+{
+  bool finished = true;
+  mtx.lock();
+  std::map<uint64_t,Send>::iterator it = sends_.find(data);
+  if (it != sends_.end()) {
+    Send &send = it->second;
+    if (result > 0) {
+      send.offset += result;
+      if (send.offset < send.buffer.size()) {
+        finished = !prepareSend(send.fd,send.buffer.data() + send.offset,send.buffer.size() - send.offset,data);
+      }
+    }
+    if (finished) {
+      sends_.erase(it);
+    }
+  }
+  mtx.unlock();
+  return finished;
+}
+
+bool Ring::cancel(int fd)
+{
+  mtx.lock();
+  io_uring_sqe *sqe = getSQE();
+  if (sqe) {
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = 0;
+    push();
+    // Submit immediately so that no request outlives the socket handle
+    submit();
+  }
+  mtx.unlock();
+  return sqe != nullptr;
+}
+
+void Ring::wait(int timeout)
+{
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  unsigned flags = 0;
+  unsigned complete = 0;
+  bool ready = (*cqHead_ != __atomic_load_n(cqTail_,__ATOMIC_ACQUIRE));
+  if (!ready && (timeout != 0)) {
+    memset(&arg,0,sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeout > 0) {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (timeout % 1000) * 1000000L;
+      arg.ts = (uint64_t)&ts;
+    }
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    complete = 1;
+  }
+  mtx.lock();
+  unsigned count = queued();
+  if (flags == 0) {
+    // Nothing is waited for, so the submission is made under the lock like those of other threads
+    if (count > 0) {
+      submit();
+    }
+    mtx.unlock();
+    return;
+  }
+  mtx.unlock();
+  // The lock is not held while the thread blocks. A request queued meanwhile wakes it through EPoll.
+  if (enter(count,complete,flags,&arg) == -1) {
+    if ((errno != ETIME) && (errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+      error("io_uring_enter",strerror(errno));
+    }
+  }
+}
+
+bool Ring::peek(io_uring_cqe &cqe)
+{
+  unsigned head = *cqHead_;
+  if (head == __atomic_load_n(cqTail_,__ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  cqe = cqes_[head & *cqMask_];
+  return true;
+}
+
+void Ring::advance()
+{
+  __atomic_store_n(cqHead_,*cqHead_ + 1,__ATOMIC_RELEASE);
+}
+
+void Ring::recycle(uint16_t id)
+{
+  if (!bufRing_) return;
+  // Index the ring directly: the flexible array in io_uring_buf_ring has a different offset in C++
+  struct io_uring_buf *buf = reinterpret_cast<struct io_uring_buf*>(bufRing_) + (bufTail_ & (bufferCount_ - 1));
+  buf->addr = (uint64_t)buffer(id);
+  buf->len = bufferSize_;
+  buf->bid = id;
+  ++bufTail_;
+  __atomic_store_n(&bufRing_->tail,bufTail_,__ATOMIC_RELEASE);
+}
+
+} // namespace tcp
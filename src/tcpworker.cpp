@@ -0,0 +1,115 @@
+#include "tcpworker.h"
+
+namespace tcp {
+
+using namespace std;
+
+// The pool and worker index of the calling thread, if it is a worker thread
+static thread_local WorkerPool *currentPool = nullptr;
+static thread_local size_t currentWorker = 0;
+
+WorkerPool::WorkerPool(size_t count)
+{
+  if (count == 0) {
+    count = max<size_t>(thread::hardware_concurrency(),1);
+  }
+  for (size_t i=0;i<count;++i) {
+    workers_.push_back(unique_ptr<Worker>(new Worker()));
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  stop();
+  for (size_t i=0;i<workers_.size();++i) {
+    for (size_t j=0;j<workers_[i]->tasks.size();++j) {
+      delete workers_[i]->tasks[j];
+    }
+  }
+}
+
+void WorkerPool::start()
+{
+  if (!running_) {
+    running_ = true;
+    for (size_t i=0;i<workers_.size();++i) {
+      threads_.push_back(thread(&WorkerPool::run,this,i));
+    }
+  }
+}
+
+void WorkerPool::stop()
+{
+  if (running_) {
+    mtx.lock();
+    running_ = false;
+    mtx.unlock();
+    idle_.notify_all();
+    for (size_t i=0;i<threads_.size();++i) {
+      threads_[i].join();
+    }
+    threads_.clear();
+  }
+}
+
+void WorkerPool::enqueue(Task *task)
+{
+  size_t index = (currentPool == this) ? currentWorker : (next_++ % workers_.size());
+  Worker &worker = *workers_[index];
+  worker.mtx.lock();
+  worker.tasks.push_back(task);
+  worker.mtx.unlock();
+  // Taking mtx orders the increment with a worker that is about to wait
+  mtx.lock();
+  ++pending_;
+  mtx.unlock();
+  idle_.notify_one();
+}
+
+Task *WorkerPool::take(size_t index)
+{
+  Task *task = nullptr;
+  for (size_t i=0;(i<workers_.size()) && !task;++i) {
+    Worker &worker = *workers_[(index + i) % workers_.size()];
+    worker.mtx.lock();
+    if (!worker.tasks.empty()) {
+      if (i == 0) {
+        task = worker.tasks.front();
+        worker.tasks.pop_front();
+      } else {
+        task = worker.tasks.back();
+        worker.tasks.pop_back();
+      }
+    }
+    worker.mtx.unlock();
+  }
+  if (task) {
+    --pending_;
+  }
+  return task;
+}
+
+void WorkerPool::run(size_t index)
+{
+  currentPool = this;
+  currentWorker = index;
+  while (true) {
+    Task *task = take(index);
+    if (task) {
+      task->run();
+      delete task;
+      continue;
+    }
+    unique_lock<mutex> lock(mtx);
+    if ((pending_ == 0) && !running_) {
+      break;
+    }
+    idle_.wait(lock,[this]{ return (pending_ > 0) || !running_; });
+    if ((pending_ == 0) && !running_) {
+      break;
+    }
+  }
+  currentPool = nullptr;
+}
+
+} // namespace tcp
@@ -0,0 +1,80 @@
+/** @file    accept.cpp
+ *  @brief   Compares accepting one connection per EPOLLIN event with accepting them in batches
+ *  @details A client opens connections in bursts, sends a byte on each and waits for the server to close
+ *           it, so the listen backlog of the server fills up between polls. With an accept batch of 1 the
+ *           server goes round the event loop for every connection. With a larger batch it drains up to
+ *           that many from the backlog per event. Reports connections per second and system calls per
+ *           connection made by the server. Usage: acceptbench [connections]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include "bench.h"
+
+static const size_t BURST = 256;
+static const int BACKLOG = 1024;
+
+/** @brief A session that closes the connection once it receives a byte */
+class CloseSession : public Session {
+  public:
+    CloseSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {}
+  protected:
+    void dataAvailable() override {
+      consume(available());
+      disconnect();
+    }
+};
+
+/** @brief Opens count connections to port in bursts and waits for the server to close each of them */
+static bool connectAll(in_port_t port, size_t count)
+{
+  bool result = true;
+  for (size_t done=0;result && (done < count);done+=BURST) {
+    vector<int> fds;
+    for (size_t i=0;result && (i < min(BURST,count - done));++i) {
+      fds.push_back(connectTo(port));
+      result = (fds.back() != -1) && writeAll(fds.back(),"x",1);
+    }
+    for (size_t i=0;i<fds.size();++i) {
+      char c;
+      if (fds[i] != -1) {
+        result = result && (::read(fds[i],&c,1) == 0);
+        ::close(fds[i]);
+      }
+    }
+  }
+  return result;
+}
+
+static Run run(size_t batch, in_port_t port, size_t count, bool trace)
+{
+  return runServer([&]{
+    EPoll epoll;
+    BenchServer<CloseSession> server(epoll);
+    server.setAcceptBatch(batch);
+    server.start(port,string("127.0.0.1"),false,BACKLOG);
+    serveUntilIdle(epoll,server,count);
+    server.stop();
+  },[&]{
+    return connectAll(port,count);
+  },trace);
+}
+
+/** @brief Prints the connection rate and system calls per connection of one batch size */
+static void report(size_t batch, in_port_t port, size_t count)
+{
+  Run timed = run(batch,port,count,false);
+  Run traced = run(batch,port + 1,count,true);
+  cout << setw(11) << batch << fixed << setprecision(0)
+       << setw(15) << count / timed.seconds << "  " << setprecision(2)
+       << setw(19) << (double)traced.syscalls / count << endl;
+}
+
+int main(int argc, char** argv) {
+  size_t count = (argc > 1) ? atoi(argv[1]) : 20000;
+  cout << "accept batch  connections/s  syscalls/connection" << endl;
+  report(1,1330,count);
+  report(Server::DEFAULT_ACCEPT_BATCH,1332,count);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/** @file    adaptiveread.cpp
+ *  @brief   Compares the adaptive readv() of DataSocket with reads of a fixed size
+ *  @details A client streams a large transfer to a server in a child process. The DataSocket server
+ *           offers each readv() between 2 KiB and 256 KiB of buffer space, depending on how much the last
+ *           read returned. The fixed servers read into a buffer of one size on a plain epoll instance, as
+ *           DataSocket once did with 256 bytes. They discard the data without buffering it, so the larger of
+ *           them bound what DataSocket can reach. Reports MB/s and system calls per MiB made by the server.
+ *           Usage: readbench [megabytes]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include "bench.h"
+
+static size_t total;   /**< Bytes sent by each transfer */
+
+/** @brief A session that discards what it receives and answers with one byte once total bytes have arrived */
+class SinkSession : public Session {
+  public:
+    SinkSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {}
+  protected:
+    void dataAvailable() override {
+      received_ += consume(available());
+      if ((received_ >= total) && !answered_) {
+        answered_ = true;
+        write("!",1);
+      }
+    }
+  private:
+    size_t received_ {0};
+    bool answered_ {false};
+};
+
+static void serveDataSocket(in_port_t port)
+{
+  EPoll epoll;
+  BenchServer<SinkSession> server(epoll);
+  server.start(port,string("127.0.0.1"));
+  serveUntilIdle(epoll,server,1);
+  server.stop();
+}
+
+/** @brief Accepts one connection and reads it readSize bytes at a time until it closes */
+static void serveFixed(in_port_t port, size_t readSize)
+{
+  int listener = ::socket(AF_INET,SOCK_STREAM,0);
+  int enable = 1;
+  setsockopt(listener,SOL_SOCKET,SO_REUSEADDR,&enable,sizeof(enable));
+  struct sockaddr_in addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((::bind(listener,(struct sockaddr*)&addr,sizeof(addr)) == -1) || (::listen(listener,1) == -1)) {
+    return;
+  }
+  int fd = ::accept4(listener,nullptr,nullptr,SOCK_NONBLOCK);
+  int handle = epoll_create1(0);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  epoll_ctl(handle,EPOLL_CTL_ADD,fd,&event);
+  vector<uint8_t> buffer(readSize);
+  size_t received = 0;
+  bool answered = false;
+  bool open = true;
+  while (open) {
+    epoll_wait(handle,&event,1,-1);
+    ssize_t size;
+    do {
+      size = ::read(fd,buffer.data(),buffer.size());
+      received += (size > 0) ? size : 0;
+      open = (size != 0);
+    } while (size == (ssize_t)buffer.size());
+    if ((received >= total) && !answered) {
+      answered = true;
+      writeAll(fd,"!",1);
+    }
+  }
+  ::close(handle);
+  ::close(fd);
+  ::close(listener);
+}
+
+/** @brief Streams total bytes to port in 64 KiB writes and waits for the answer */
+static bool stream(in_port_t port)
+{
+  int fd = connectTo(port);
+  vector<uint8_t> data(65536,'x');
+  bool result = (fd != -1);
+  for (size_t sent=0;result && (sent < total);sent+=data.size()) {
+    result = writeAll(fd,data.data(),min(data.size(),total - sent));
+  }
+  char answer;
+  result = result && readAll(fd,&answer,1);
+  ::close(fd);
+  return result;
+}
+
+/** @brief Prints the throughput and system calls per MiB of one server
+ *  @details The traced transfer is a sixteenth of the size, because tracing is slow */
+static void report(const char *name, const function<void(in_port_t)> &serve, in_port_t port, size_t size)
+{
+  total = size;
+  Run timed = runServer([&]{ serve(port); },[&]{ return stream(port); },false);
+  total = max<size_t>(size / 16,16777216);
+  Run traced = runServer([&]{ serve(port + 1); },[&]{ return stream(port + 1); },true);
+  cout << setw(16) << left << name << right << fixed << setprecision(0)
+       << setw(8) << size / 1048576.0 / timed.seconds << "  " << setprecision(1)
+       << setw(12) << traced.syscalls / (total / 1048576.0) << endl;
+}
+
+int main(int argc, char** argv) {
+  size_t size = ((argc > 1) ? atoi(argv[1]) : 1024) * 1048576UL;
+  cout << "server            MB/s  syscalls/MiB" << endl;
+  report("fixed 256 B",[](in_port_t port){ serveFixed(port,256); },1310,size);
+  report("fixed 16 KiB",[](in_port_t port){ serveFixed(port,16384); },1312,size);
+  report("fixed 256 KiB",[](in_port_t port){ serveFixed(port,262144); },1316,size);
+  report("adaptive",serveDataSocket,1314,size);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,228 @@
+/** @file    bench.h
+ *  @brief   Helpers for the benchmarks that run a server in a child process
+ *  @details runServer() forks a child that runs the server while a thread of the parent runs the client
+ *           load, so the client does not share the server's event loop. If asked, the parent traces the
+ *           child with ptrace() and counts every system call it makes, including those of its threads.
+ *           The count covers the server's set up as well, so each benchmark runs enough traffic for that
+ *           to be negligible. Tracing slows the child down, so the time is measured on a separate run.
+ */
+
+#ifndef TCP_BENCH_H
+#define TCP_BENCH_H
+
+#include <iostream>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include "tcpserver.h"
+
+using namespace std;
+using namespace tcp;
+
+/** @brief A streambuf that discards the library's log messages without making a system call */
+class NullBuffer : public streambuf {
+  protected:
+    int overflow(int c) override { return c; }
+};
+
+/** @brief A server that creates sessions of class S */
+template<typename S>
+class BenchServer : public Server {
+  public:
+    BenchServer(EPoll &epoll) : Server(epoll,nullptr) {}
+    size_t accepted = 0;
+  protected:
+    Session* createSession(EPoll &epoll, const int socket, const sockaddr_in peer_address) override {
+      ++accepted;
+      return new S(epoll,*this,socket,peer_address);
+    }
+};
+
+/** @brief A session that sends back everything it receives */
+class EchoSession : public Session {
+  public:
+    EchoSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {}
+  protected:
+    void dataAvailable() override {
+      uint8_t buffer[65536];
+      size_t size;
+      while ((size = read(buffer,sizeof(buffer))) > 0) {
+        write(buffer,size);
+      }
+    }
+};
+
+/** @brief Polls epoll until server has accepted expected sessions and all of them have closed */
+template<typename S>
+void serveUntilIdle(EPoll &epoll, BenchServer<S> &server, size_t expected)
+{
+  while ((server.accepted < expected) || (server.sessionCount() > 0)) {
+    epoll.poll(100);
+  }
+}
+
+/** @brief Opens a blocking connection to port on the loopback interface
+ *  @details Retries for five seconds, because the child may not be listening yet. Returns -1 on failure. */
+inline int connectTo(in_port_t port)
+{
+  chrono::steady_clock::time_point limit = chrono::steady_clock::now() + chrono::seconds(5);
+  while (chrono::steady_clock::now() < limit) {
+    int fd = ::socket(AF_INET,SOCK_STREAM,0);
+    struct sockaddr_in addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd,(struct sockaddr*)&addr,sizeof(addr)) == 0) {
+      return fd;
+    }
+    ::close(fd);
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  return -1;
+}
+
+/** @brief Writes all of size bytes to fd, or returns false */
+inline bool writeAll(int fd, const void *data, size_t size)
+{
+  const uint8_t *p = (const uint8_t*)data;
+  while (size > 0) {
+    ssize_t res = ::write(fd,p,size);
+    if (res <= 0) {
+      return false;
+    }
+    p += res;
+    size -= res;
+  }
+  return true;
+}
+
+/** @brief Reads exactly size bytes from fd, or returns false */
+inline bool readAll(int fd, void *data, size_t size)
+{
+  uint8_t *p = (uint8_t*)data;
+  while (size > 0) {
+    ssize_t res = ::read(fd,p,size);
+    if (res <= 0) {
+      return false;
+    }
+    p += res;
+    size -= res;
+  }
+  return true;
+}
+
+/** @brief The result of runServer() */
+struct Run {
+  double seconds;   /**< Wall clock time taken by the client */
+  double cpu;       /**< User and system CPU time used by the child */
+  long syscalls;    /**< System calls made by the child, or 0 if it was not traced */
+};
+
+/** @brief Counts the system calls of the traced child pid and its threads until it exits */
+inline long traceChild(pid_t pid)
+{
+  int status;
+  waitpid(pid,&status,0);
+  ptrace(PTRACE_SETOPTIONS,pid,0,PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+  ptrace(PTRACE_SYSCALL,pid,0,0);
+  long stops = 0;
+  pid_t tid;
+  while ((tid = waitpid(-1,&status,__WALL)) != -1) {
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (tid == pid) {
+        break;
+      }
+      continue;
+    }
+    int signal = 0;
+    if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+      ++stops;
+    } else if (((status >> 16) == 0) && (WSTOPSIG(status) != SIGSTOP) && (WSTOPSIG(status) != SIGTRAP)) {
+      // Deliver real signals. New threads start with a SIGSTOP, and clone events stop with SIGTRAP.
+      signal = WSTOPSIG(status);
+    }
+    ptrace(PTRACE_SYSCALL,tid,0,signal);
+  }
+  // Each call stops once on entry and once on exit
+  return stops / 2;
+}
+
+/** @brief Runs server in a child process and client on a thread of this process
+ *  @param server [in] Serves the load and returns once the client has finished
+ *  @param client [in] Generates the load and returns false if it failed
+ *  @param trace  [in] If true, the system calls made by the child are counted */
+inline Run runServer(const function<void()> &server, const function<bool()> &client, bool trace)
+{
+  Run run = {0,0,0};
+  struct rusage before, after;
+  getrusage(RUSAGE_CHILDREN,&before);
+  pid_t pid = fork();
+  if (pid == 0) {
+    static NullBuffer null;
+    static ostream discard(&null);
+    setLogStream(&discard);
+    if (trace) {
+      ptrace(PTRACE_TRACEME,0,0,0);
+      raise(SIGSTOP);
+    }
+    server();
+    _exit(EXIT_SUCCESS);
+  }
+  bool ok = true;
+  thread load([&]{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    ok = client();
+    run.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  });
+  if (trace) {
+    run.syscalls = traceChild(pid);
+  } else {
+    waitpid(pid,nullptr,0);
+  }
+  load.join();
+  getrusage(RUSAGE_CHILDREN,&after);
+  run.cpu = (after.ru_utime.tv_sec - before.ru_utime.tv_sec) + (after.ru_stime.tv_sec - before.ru_stime.tv_sec) +
+            ((after.ru_utime.tv_usec - before.ru_utime.tv_usec) + (after.ru_stime.tv_usec - before.ru_stime.tv_usec)) / 1e6;
+  if (!ok) {
+    cerr << "The client failed" << endl;
+  }
+  return run;
+}
+
+/** @brief Sends rounds of size byte messages on each of count connections to port and reads the echoes
+ *  @details Every connection has a message in flight at once, so the server sees concurrent load */
+inline bool pingPong(in_port_t port, size_t count, size_t rounds, size_t size)
+{
+  vector<int> fds;
+  for (size_t i=0;i<count;++i) {
+    fds.push_back(connectTo(port));
+    if (fds.back() == -1) {
+      return false;
+    }
+  }
+  vector<uint8_t> message(size,'x'), reply(size);
+  bool result = true;
+  for (size_t round=0;result && (round < rounds);++round) {
+    for (size_t i=0;result && (i < fds.size());++i) {
+      result = writeAll(fds[i],message.data(),size);
+    }
+    for (size_t i=0;result && (i < fds.size());++i) {
+      result = readAll(fds[i],reply.data(),size);
+    }
+  }
+  for (size_t i=0;i<fds.size();++i) {
+    ::close(fds[i]);
+  }
+  return result;
+}
+
+#endif // include guard
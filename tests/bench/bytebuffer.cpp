@@ -0,0 +1,81 @@
+/** @file    bytebuffer.cpp
+ *  @brief   Compares ByteBuffer with the deque<uint8_t> that the socket buffers used before it
+ *  @details Each round appends chunks of data, as a socket does when it reads or is written to, and then
+ *           drains them in reads of a different size, as a socket does when it sends or its owner reads.
+ *           Usage: bytebufferbench [megabytes]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include "tcpbuffer.h"
+
+using namespace std;
+using namespace tcp;
+
+static const size_t BACKLOG = 262144; /**< Bytes appended before each drain */
+
+static size_t runDeque(size_t total, size_t writeSize, size_t readSize)
+{
+  deque<uint8_t> buffer;
+  vector<uint8_t> in(writeSize,'x'), out(readSize);
+  size_t checksum = 0;
+  for (size_t done=0;done<total;done+=BACKLOG) {
+    for (size_t size=0;size<BACKLOG;size+=writeSize) {
+      buffer.insert(buffer.end(),in.begin(),in.end());
+    }
+    while (!buffer.empty()) {
+      size_t size = min(readSize,buffer.size());
+      copy(buffer.begin(),buffer.begin() + size,out.begin());
+      buffer.erase(buffer.begin(),buffer.begin() + size);
+      checksum += out[size - 1];
+    }
+  }
+  return checksum;
+}
+
+static size_t runByteBuffer(size_t total, size_t writeSize, size_t readSize)
+{
+  ByteBuffer buffer;
+  vector<uint8_t> in(writeSize,'x'), out(readSize);
+  size_t checksum = 0;
+  for (size_t done=0;done<total;done+=BACKLOG) {
+    for (size_t size=0;size<BACKLOG;size+=writeSize) {
+      buffer.append(in.data(),in.size());
+    }
+    while (!buffer.empty()) {
+      size_t size = buffer.read(out.data(),readSize);
+      checksum += out[size - 1];
+    }
+  }
+  return checksum;
+}
+
+template<typename Run>
+static double measure(Run run, size_t total, size_t writeSize, size_t readSize)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  size_t checksum = run(total,writeSize,readSize);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (checksum == 0) {
+    cerr << "Nothing was read" << endl;
+  }
+  return total / seconds / 1048576.0;
+}
+
+int main(int argc, char** argv) {
+  size_t total = ((argc > 1) ? atoi(argv[1]) : 256) * 1048576UL;
+  const size_t sizes[][2] = { {64,1024}, {1460,4096}, {16384,65536}, {65536,1460} };
+  cout << "write    read     deque MB/s  ByteBuffer MB/s" << endl;
+  for (size_t i=0;i<sizeof(sizes) / sizeof(sizes[0]);++i) {
+    double deque = measure(runDeque,total,sizes[i][0],sizes[i][1]);
+    double chunked = measure(runByteBuffer,total,sizes[i][0],sizes[i][1]);
+    cout << setw(8) << left << sizes[i][0] << " " << setw(8) << sizes[i][1] << " " << right << fixed << setprecision(0)
+         << setw(11) << deque << "  " << setw(15) << chunked << endl;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+/** @file    findbyte.cpp
+ *  @brief   Compares findByte() with findByteScalar() and memchr()
+ *  @details Searches buffers for a delimiter placed at the end, as when a long record is scanned, and for
+ *           delimiters spaced like lines of text. Usage: findbytebench [megabytes]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include "tcpscan.h"
+
+using namespace std;
+using namespace tcp;
+
+typedef const uint8_t *(*Search)(const uint8_t *begin, const uint8_t *end, uint8_t byte);
+
+static const uint8_t *searchMemchr(const uint8_t *begin, const uint8_t *end, uint8_t byte)
+{
+  const uint8_t *result = (const uint8_t*)memchr(begin,byte,end - begin);
+  return result ? result : end;
+}
+
+/** @brief Returns the throughput in MB/s of finding every delimiter in data, total bytes in all */
+static double measure(Search search, const vector<uint8_t> &data, size_t total)
+{
+  size_t found = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (size_t done=0;done<total;done+=data.size()) {
+    const uint8_t *end = data.data() + data.size();
+    for (const uint8_t *p=data.data();p<end;++p) {
+      p = search(p,end,'\n');
+      found += (p != end);
+    }
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (found == 0) {
+    cerr << "No delimiter was found" << endl;
+  }
+  return total / seconds / 1048576.0;
+}
+
+int main(int argc, char** argv) {
+  size_t total = ((argc > 1) ? atoi(argv[1]) : 4096) * 1048576UL;
+  const size_t spacing[] = { 16, 80, 1024, 65536, 1048576 };
+  const char *kernels[] = { "scalar", "SSE2", "AVX2" };
+  cout << "findByte uses " << kernels[(int)scanKernel()] << endl;
+  cout << "spacing  scalar MB/s  memchr MB/s  findByte MB/s" << endl;
+  for (size_t i=0;i<sizeof(spacing) / sizeof(spacing[0]);++i) {
+    vector<uint8_t> data(1048576,'x');
+    for (size_t j=spacing[i]-1;j<data.size();j+=spacing[i]) {
+      data[j] = '\n';
+    }
+    cout << setw(8) << left << spacing[i] << right << fixed << setprecision(0)
+         << setw(12) << measure(findByteScalar,data,total / 8) << " "
+         << setw(12) << measure(searchMemchr,data,total) << " "
+         << setw(14) << measure(findByte,data,total) << endl;
+  }
+  return EXIT_SUCCESS;
+}
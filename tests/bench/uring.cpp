@@ -0,0 +1,52 @@
+/** @file    uring.cpp
+ *  @brief   Compares the system calls made by the io_uring and epoll backends under echo load
+ *  @details Connections exchange small messages with an echo server, each with one message in flight.
+ *           The epoll backend makes at least an epoll_wait(), a read() and a send() per wake up. The
+ *           io_uring backend keeps a multishot receive on each socket and submits its sends together
+ *           with the wait in a single io_uring_enter() per poll(). Reports messages per second and system
+ *           calls per message made by the server. Usage: uringbench [rounds]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include "bench.h"
+
+static const size_t CONNECTIONS = 16;
+static const size_t MESSAGE_SIZE = 64;
+
+static Run run(EPollBackend backend, bool edgeTriggered, in_port_t port, size_t rounds, bool trace)
+{
+  return runServer([&]{
+    EPoll epoll(backend,edgeTriggered);
+    if (epoll.backend() != backend) {
+      cerr << "io_uring is not available. The epoll backend was measured instead." << endl;
+    }
+    BenchServer<EchoSession> server(epoll);
+    server.start(port,string("127.0.0.1"));
+    serveUntilIdle(epoll,server,CONNECTIONS);
+    server.stop();
+  },[&]{
+    return pingPong(port,CONNECTIONS,rounds,MESSAGE_SIZE);
+  },trace);
+}
+
+/** @brief Prints the throughput and system calls per message of one backend */
+static void report(const char *name, EPollBackend backend, bool edgeTriggered, in_port_t port, size_t rounds)
+{
+  Run timed = run(backend,edgeTriggered,port,rounds,false);
+  Run traced = run(backend,edgeTriggered,port + 1,rounds,true);
+  double messages = (double)rounds * CONNECTIONS;
+  cout << setw(24) << left << name << right << fixed << setprecision(0)
+       << setw(10) << messages / timed.seconds << "  " << setprecision(2)
+       << setw(16) << traced.syscalls / messages << endl;
+}
+
+int main(int argc, char** argv) {
+  size_t rounds = (argc > 1) ? atoi(argv[1]) : 5000;
+  cout << "backend                 messages/s  syscalls/message" << endl;
+  report("epoll, level triggered",EPollBackend::EPOLL,false,1340,rounds);
+  report("epoll, edge triggered",EPollBackend::EPOLL,true,1342,rounds);
+  report("io_uring",EPollBackend::IO_URING,false,1344,rounds);
+  return EXIT_SUCCESS;
+}
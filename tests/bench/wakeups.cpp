@@ -0,0 +1,59 @@
+/** @file    wakeups.cpp
+ *  @brief   Compares level triggered and edge triggered EPoll instances under echo load
+ *  @details Connections exchange small messages with an echo server, each with one message in flight. A
+ *           level triggered socket changes its events with epoll_ctl() to wait for EPOLLOUT, and wakes for
+ *           it, whenever its output is not sent at once. An edge triggered socket registers once and sends
+ *           straight away. Reports messages per second and system calls per message made by the server.
+ *           Usage: wakeupbench [rounds]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include "bench.h"
+
+static const size_t CONNECTIONS = 16;
+static const size_t MESSAGE_SIZE = 64;
+
+/** @brief An echo session that sends each reply from dataAvailable() */
+class WriteThroughSession : public EchoSession {
+  public:
+    WriteThroughSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : EchoSession(epoll,server,socket,peer_addr) {
+      setFlushPolicy(FlushPolicy::WRITE_THROUGH);
+    }
+};
+
+template<typename S>
+static Run run(bool edgeTriggered, in_port_t port, size_t rounds, bool trace)
+{
+  return runServer([&]{
+    EPoll epoll(EPollBackend::EPOLL,edgeTriggered);
+    BenchServer<S> server(epoll);
+    server.start(port,string("127.0.0.1"));
+    serveUntilIdle(epoll,server,CONNECTIONS);
+    server.stop();
+  },[&]{
+    return pingPong(port,CONNECTIONS,rounds,MESSAGE_SIZE);
+  },trace);
+}
+
+/** @brief Prints the throughput and system calls per message of one mode */
+template<typename S>
+static void report(const char *name, bool edgeTriggered, in_port_t port, size_t rounds)
+{
+  Run timed = run<S>(edgeTriggered,port,rounds,false);
+  Run traced = run<S>(edgeTriggered,port + 1,rounds,true);
+  double messages = (double)rounds * CONNECTIONS;
+  cout << setw(32) << left << name << right << fixed << setprecision(0)
+       << setw(10) << messages / timed.seconds << "  " << setprecision(2)
+       << setw(16) << traced.syscalls / messages << endl;
+}
+
+int main(int argc, char** argv) {
+  size_t rounds = (argc > 1) ? atoi(argv[1]) : 5000;
+  cout << "mode                            messages/s  syscalls/message" << endl;
+  report<EchoSession>("level triggered",false,1300,rounds);
+  report<WriteThroughSession>("level triggered, write through",false,1302,rounds);
+  report<EchoSession>("edge triggered",true,1304,rounds);
+  return EXIT_SUCCESS;
+}
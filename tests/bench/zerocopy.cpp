@@ -0,0 +1,107 @@
+/** @file    zerocopy.cpp
+ *  @brief   Compares MSG_ZEROCOPY sends with copying sends on a large transfer
+ *  @details A server in a child process streams a large transfer to a client, refilling its outputBuffer
+ *           from onWriteDrained(). The copy server writes from a plain array, so each byte is copied into
+ *           the outputBuffer and again into the kernel. The shared server writes a SharedBuffer, which
+ *           skips the first copy. The zerocopy server also sends with MSG_ZEROCOPY, which skips the second.
+ *           Reports MB/s, CPU seconds used by the server per GiB, and system calls per MiB. On the loopback
+ *           interface the kernel copies zerocopy sends anyway, so there only the extra cost of pinning and
+ *           completion notifications shows. Run it against a remote client to see the gain.
+ *           Usage: zerocopybench [megabytes]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include "bench.h"
+
+static const size_t CHUNK_SIZE = 262144;
+
+enum class Mode { COPY, SHARED, ZEROCOPY };
+
+static size_t total;   /**< Bytes sent by each transfer */
+static Mode mode;
+
+/** @brief A session that sends total bytes once it receives a byte, keeping its outputBuffer between the watermarks */
+class SourceSession : public Session {
+  public:
+    SourceSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {
+      setWatermarks(4194304,1048576);
+      if (mode == Mode::ZEROCOPY) {
+        setZeroCopy(65536);
+      }
+    }
+  protected:
+    void dataAvailable() override {
+      uint8_t request;
+      if (read(&request,1) == 1) {
+        fill();
+      }
+    }
+    void onWriteDrained() override {
+      fill();
+    }
+  private:
+    void fill() {
+      static vector<uint8_t> data(CHUNK_SIZE,'x');
+      static SharedBuffer shared(data.data(),data.size());
+      while (!writeBlocked() && (sent_ < total)) {
+        size_t size = min(CHUNK_SIZE,total - sent_);
+        sent_ += (mode == Mode::COPY) ? write(data.data(),size) : write(shared.slice(0,size));
+      }
+    }
+    size_t sent_ {0};
+};
+
+/** @brief Requests total bytes from port and reads them */
+static bool receive(in_port_t port)
+{
+  int fd = connectTo(port);
+  bool result = (fd != -1) && writeAll(fd,"?",1);
+  vector<uint8_t> buffer(CHUNK_SIZE);
+  size_t received = 0;
+  while (result && (received < total)) {
+    ssize_t size = ::read(fd,buffer.data(),buffer.size());
+    result = (size > 0);
+    received += result ? size : 0;
+  }
+  ::close(fd);
+  return result;
+}
+
+static Run run(in_port_t port, bool trace)
+{
+  return runServer([&]{
+    EPoll epoll;
+    BenchServer<SourceSession> server(epoll);
+    server.start(port,string("127.0.0.1"));
+    serveUntilIdle(epoll,server,1);
+    server.stop();
+  },[&]{
+    return receive(port);
+  },trace);
+}
+
+/** @brief Prints the throughput, CPU time and system calls of one server
+ *  @details The traced transfer is a sixteenth of the size, because tracing is slow */
+static void report(const char *name, Mode value, in_port_t port, size_t size)
+{
+  mode = value;
+  total = size;
+  Run timed = run(port,false);
+  total = max<size_t>(size / 16,16777216);
+  Run traced = run(port + 1,true);
+  cout << setw(10) << left << name << right << fixed << setprecision(0)
+       << setw(8) << size / 1048576.0 / timed.seconds << "  " << setprecision(3)
+       << setw(12) << timed.cpu / (size / 1073741824.0) << "  " << setprecision(1)
+       << setw(12) << traced.syscalls / (total / 1048576.0) << endl;
+}
+
+int main(int argc, char** argv) {
+  size_t size = ((argc > 1) ? atoi(argv[1]) : 1024) * 1048576UL;
+  cout << "server        MB/s   CPU s/GiB  syscalls/MiB" << endl;
+  report("copy",Mode::COPY,1320,size);
+  report("shared",Mode::SHARED,1322,size);
+  report("zerocopy",Mode::ZEROCOPY,1324,size);
+  return EXIT_SUCCESS;
+}
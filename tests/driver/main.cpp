@@ -1,50 +1,1720 @@
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
 #include "echoserver.h"
 #include "echoclient.h"
 #include "tcpclient.h"
+#include "tcpbuffer.h"
+#include "tcpframing.h"
+#include "tcpscan.h"
+#include "tcpslotmap.h"
+#include "tcptimer.h"
+#include "tcppool.h"
 
 using namespace std;
 
-EchoServer* server;
-EchoClient* client;
+/** @brief A server that creates sessions of class S */
+template<typename S>
+class TestServer : public Server {
+  public:
+    TestServer(EPoll &epoll) : Server(epoll,nullptr) {}
+    size_t sessionCount() { return sessions.size(); }
+  protected:
+    Session* createSession(EPoll &epoll, const int socket, const sockaddr_in peer_address) override {
+      return new S(epoll,*this,socket,peer_address);
+    }
+};
 
-int createServer() {
-  server = new EchoServer(1200);
-  if (server->listening()) {
-    return EXIT_SUCCESS;
-  } else {
-    return EXIT_FAILURE;
+/** @brief Opens a blocking connection to port on the loopback interface, or returns -1
+ *  @details Reads time out after five seconds, so that a test fails instead of hanging */
+int connectTo(in_port_t port) {
+  int fd = ::socket(AF_INET,SOCK_STREAM,0);
+  struct timeval timeout = {5,0};
+  setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+  struct sockaddr_in addr;
+  memset(&addr,0,sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::connect(fd,(struct sockaddr*)&addr,sizeof(addr)) == -1) {
+    ::close(fd);
+    return -1;
   }
+  return fd;
 }
 
-int destroyServer() {
-  server = new EchoServer(1200);
-  if (server != nullptr) {
-    delete server;
-    return EXIT_SUCCESS;
-  } else {
-    return EXIT_FAILURE;
+/** @brief Polls epoll until done() returns true or five seconds have passed */
+template<typename Done>
+bool pollUntil(EPoll &epoll, Done done) {
+  chrono::steady_clock::time_point limit = chrono::steady_clock::now() + chrono::seconds(5);
+  while (!done()) {
+    if (chrono::steady_clock::now() > limit) {
+      return false;
+    }
+    epoll.poll(10);
   }
+  return true;
+}
+
+vector<vector<uint8_t>> received;
+
+/** @brief Generates count messages of random content, every tenth one larger than a buffer block */
+vector<vector<uint8_t>> randomMessages(size_t count, uint64_t limit) {
+  vector<vector<uint8_t>> result(count);
+  for (size_t i=0;i<count;++i) {
+    result[i].resize(min<uint64_t>(rand() % ((i % 10 == 0) ? 60000 : 300),limit));
+    for (size_t j=0;j<result[i].size();++j) {
+      result[i][j] = (uint8_t)rand();
+    }
+  }
+  return result;
+}
+
+int createServer() {
+  EPoll epoll;
+  EchoServer server(epoll,nullptr);
+  server.start(1200,string("127.0.0.1"));
+  bool listening = server.listening();
+  server.stop();
+  return listening ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int destroyServer() {
+  EPoll epoll;
+  EchoServer *server = new EchoServer(epoll,nullptr);
+  server->start(1201,string("127.0.0.1"));
+  server->stop();
+  delete server;
+  return (epoll.size() == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int createClient() {
-  client = new EchoClient(false);
-  if (client->state() == EchoClient::State::UNCONNECTED) {
-    return EXIT_SUCCESS;
-  } else {
+  EPoll epoll;
+  EchoClient client(epoll,nullptr);
+  return (client.state() == SocketState::UNCONNECTED) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int destroyClient() {
+  EPoll epoll;
+  EchoClient *client = new EchoClient(epoll,nullptr);
+  delete client;
+  return (epoll.size() == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Compares random operations on a ByteBuffer with small blocks against a deque */
+int byteBuffer() {
+  ByteBuffer buffer(64);
+  deque<uint8_t> model;
+  vector<uint8_t> data(1000);
+  srand(9);
+  for (int i=0;i<20000;++i) {
+    size_t size = rand() % data.size();
+    switch (rand() % 6) {
+      case 0:
+        for (size_t j=0;j<size;++j) {
+          data[j] = (uint8_t)rand();
+        }
+        buffer.append(data.data(),size);
+        model.insert(model.end(),data.begin(),data.begin() + size);
+        break;
+      case 1: {
+        struct iovec iov[32];
+        size_t count = buffer.reserve(size,iov,32);
+        size_t written = 0;
+        for (size_t j=0;j<count;++j) {
+          for (size_t k=0;(k < iov[j].iov_len) && (written < size);++k) {
+            ((uint8_t*)iov[j].iov_base)[k] = (uint8_t)written;
+            model.push_back((uint8_t)written++);
+          }
+        }
+        buffer.commit(written);
+        break;
+      }
+      case 2: {
+        size_t read = buffer.read(data.data(),size);
+        if ((read != min(size,model.size())) || !equal(data.begin(),data.begin() + read,model.begin())) {
+          return EXIT_FAILURE;
+        }
+        model.erase(model.begin(),model.begin() + read);
+        break;
+      }
+      case 3: {
+        size_t consumed = buffer.consume(size);
+        if (consumed != min(size,model.size())) {
+          return EXIT_FAILURE;
+        }
+        model.erase(model.begin(),model.begin() + consumed);
+        break;
+      }
+      case 4: {
+        size_t offset = model.empty() ? 0 : rand() % model.size();
+        size_t copied = buffer.peek(data.data(),size,offset);
+        if ((copied != min(size,model.size() - offset)) || !equal(data.begin(),data.begin() + copied,model.begin() + offset)) {
+          return EXIT_FAILURE;
+        }
+        break;
+      }
+      case 5: {
+        uint8_t byte = (uint8_t)rand();
+        size_t offset = model.empty() ? 0 : rand() % model.size();
+        deque<uint8_t>::iterator it = find(model.begin() + offset,model.end(),byte);
+        size_t expected = (it == model.end()) ? ByteBuffer::NOT_FOUND : it - model.begin();
+        if (buffer.find(byte,offset) != expected) {
+          return EXIT_FAILURE;
+        }
+        break;
+      }
+    }
+    if (buffer.size() != model.size()) {
+      return EXIT_FAILURE;
+    }
+  }
+  buffer.clear();
+  return buffer.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief A framed session that sends every message back */
+template<typename Header>
+class FramedEchoSession : public FramedSession<Header> {
+  public:
+    FramedEchoSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : FramedSession<Header>(epoll,server,socket,peer_addr) {}
+  protected:
+    void messageReceived(const uint8_t *data, size_t size) override { this->writeMessage(data,size); }
+};
+
+/** @brief A framed client that records every message */
+template<typename Header>
+class FramedRecorder : public FramedClient<Header> {
+  public:
+    FramedRecorder(EPoll &epoll) : FramedClient<Header>(epoll,nullptr) {}
+  protected:
+    void messageReceived(const uint8_t *data, size_t size) override { received.push_back(vector<uint8_t>(data,data + size)); }
+};
+
+/** @brief Sends messages through a framed echo session and checks that they return intact */
+template<typename Header>
+bool framedEcho(in_port_t port) {
+  EPoll epoll;
+  TestServer<FramedEchoSession<Header>> server(epoll);
+  server.start(port,string("127.0.0.1"));
+  FramedRecorder<Header> client(epoll);
+  client.connect("127.0.0.1",to_string(port).c_str());
+  vector<vector<uint8_t>> messages = randomMessages(200,Header::limit());
+  received.clear();
+  bool result = pollUntil(epoll,[&]{ return client.state() == SocketState::CONNECTED; });
+  for (size_t i=0;result && (i < messages.size());++i) {
+    result = client.writeMessage(messages[i].data(),messages[i].size());
+  }
+  result = result && pollUntil(epoll,[&]{ return received.size() >= messages.size(); }) && (received == messages);
+  client.disconnect();
+  server.stop();
+  return result;
+}
+
+int framedMessages() {
+  srand(21);
+  bool result = framedEcho<BigEndian16Header>(1210) && framedEcho<BigEndian32Header>(1211) &&
+                framedEcho<LittleEndian64Header>(1212) && framedEcho<VarintHeader>(1213);
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief A framed session that records every message */
+class FramedSink : public FramedSession<VarintHeader> {
+  public:
+    FramedSink(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : FramedSession<VarintHeader>(epoll,server,socket,peer_addr) {
+      setMaxFrameSize(1000);
+    }
+  protected:
+    void messageReceived(const uint8_t *data, size_t size) override { received.push_back(vector<uint8_t>(data,data + size)); }
+};
+
+/** @brief Delivers frames whose header and body arrive a byte at a time */
+int framedPartial() {
+  EPoll epoll;
+  TestServer<FramedSink> server(epoll);
+  server.start(1214,string("127.0.0.1"));
+  int fd = connectTo(1214);
+  received.clear();
+  // A 300 byte message has a two byte varint header
+  vector<uint8_t> frame;
+  uint8_t header[VarintHeader::MAX_SIZE];
+  frame.insert(frame.end(),header,header + VarintHeader::encode(300,header));
+  for (size_t i=0;i<300;++i) {
+    frame.push_back((uint8_t)i);
+  }
+  frame.push_back(0);
+  bool result = (fd != -1);
+  for (size_t i=0;result && (i < frame.size());++i) {
+    result = (::write(fd,&frame[i],1) == 1);
+    epoll.poll(1);
+  }
+  result = result && pollUntil(epoll,[]{ return received.size() == 2; }) &&
+           (received[0] == vector<uint8_t>(frame.begin() + 2,frame.end() - 1)) && received[1].empty();
+  ::close(fd);
+  server.stop();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Shuts the connection down when a header announces a frame larger than maxFrameSize() */
+int frameTooLarge() {
+  EPoll epoll;
+  TestServer<FramedSink> server(epoll);
+  server.start(1215,string("127.0.0.1"));
+  int fd = connectTo(1215);
+  received.clear();
+  uint8_t frame[2 * VarintHeader::MAX_SIZE + 1];
+  size_t size = VarintHeader::encode(1,frame);
+  frame[size++] = 0;
+  size += VarintHeader::encode(1001,frame + size);
+  bool result = (fd != -1) && pollUntil(epoll,[&]{ return server.sessionCount() == 1; }) &&
+                (::write(fd,frame,size) == (ssize_t)size);
+  result = result && pollUntil(epoll,[&]{ return server.sessionCount() == 0; }) && (received.size() == 1);
+  uint8_t byte;
+  result = result && (::read(fd,&byte,1) == 0);
+  ::close(fd);
+  server.stop();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Compares findByte() and findByteScalar() with memchr() at every alignment and many lengths */
+int findByte() {
+  vector<uint8_t> data(600);
+  srand(22);
+  for (int i=0;i<100000;++i) {
+    size_t offset = rand() % 64;
+    size_t size = rand() % (data.size() - offset);
+    for (size_t j=0;j<data.size();++j) {
+      data[j] = 'a' + rand() % 20;
+    }
+    if (rand() % 4) {
+      data[offset + rand() % (size + 1)] = '\n';
+    }
+    const uint8_t *begin = data.data() + offset;
+    const uint8_t *end = begin + size;
+    const uint8_t *expected = (const uint8_t*)memchr(begin,'\n',size);
+    if (!expected) {
+      expected = end;
+    }
+    if ((tcp::findByte(begin,end,'\n') != expected) || (findByteScalar(begin,end,'\n') != expected)) {
+      cerr << "Mismatch with kernel " << (int)scanKernel() << endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+/** @brief A delimited session that sends every record back */
+class DelimitedEchoSession : public DelimitedSession {
+  public:
+    DelimitedEchoSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : DelimitedSession(epoll,server,socket,peer_addr) {}
+  protected:
+    void recordReceived(const uint8_t *data, size_t size) override { writeRecord(data,size); }
+};
+
+/** @brief A delimited client that records every record */
+class DelimitedRecorder : public DelimitedClient {
+  public:
+    DelimitedRecorder(EPoll &epoll) : DelimitedClient(epoll,nullptr) {}
+  protected:
+    void recordReceived(const uint8_t *data, size_t size) override { received.push_back(vector<uint8_t>(data,data + size)); }
+};
+
+/** @brief Echoes records sent in pieces, some ending in CRLF, and checks that they return intact */
+int delimitedRecords() {
+  EPoll epoll;
+  TestServer<DelimitedEchoSession> server(epoll);
+  server.start(1220,string("127.0.0.1"));
+  DelimitedRecorder client(epoll);
+  client.connect("127.0.0.1","1220");
+  srand(22);
+  vector<vector<uint8_t>> records = randomMessages(200,UINT64_MAX);
+  received.clear();
+  bool result = pollUntil(epoll,[&]{ return client.state() == SocketState::CONNECTED; });
+  for (size_t i=0;result && (i < records.size());++i) {
+    vector<uint8_t> &record = records[i];
+    for (size_t j=0;j<record.size();++j) {
+      record[j] = 'a' + record[j] % 26;
+    }
+    vector<uint8_t> line(record);
+    if (i % 3 == 0) {
+      line.push_back('\r');
+    }
+    line.push_back('\n');
+    // Each piece is delivered separately, so the search resumes where the last one stopped
+    for (size_t offset=0;result && (offset < line.size());) {
+      size_t size = min<size_t>(line.size() - offset,1 + rand() % 5000);
+      result = (client.write(line.data() + offset,size) == size);
+      offset += size;
+      epoll.poll(0);
+    }
+  }
+  result = result && pollUntil(epoll,[&]{ return received.size() >= records.size(); }) && (received == records);
+  client.disconnect();
+  server.stop();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief A delimited session that accepts records of up to 100 bytes */
+class DelimitedSink : public DelimitedSession {
+  public:
+    DelimitedSink(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : DelimitedSession(epoll,server,socket,peer_addr) {
+      setMaxRecordSize(100);
+    }
+  protected:
+    void recordReceived(const uint8_t *data, size_t size) override { received.push_back(vector<uint8_t>(data,data + size)); }
+};
+
+/** @brief Shuts the connection down when more than maxRecordSize() bytes arrive without a delimiter */
+int recordTooLarge() {
+  EPoll epoll;
+  TestServer<DelimitedSink> server(epoll);
+  server.start(1221,string("127.0.0.1"));
+  int fd = connectTo(1221);
+  received.clear();
+  string data = "first\n" + string(101,'x');
+  bool result = (fd != -1) && pollUntil(epoll,[&]{ return server.sessionCount() == 1; }) &&
+                (::write(fd,data.data(),data.size()) == (ssize_t)data.size());
+  result = result && pollUntil(epoll,[&]{ return server.sessionCount() == 0; }) && (received.size() == 1) && 
+           (string(received[0].begin(),received[0].end()) == "first");
+  uint8_t byte;
+  result = result && (::read(fd,&byte,1) == 0);
+  ::close(fd);
+  server.stop();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Checks that erased and reused slots reject the handles issued for earlier values */
+int slotMapGenerations() {
+  SlotMap<int> map;
+  SlotHandle first = map.insert(1);
+  SlotHandle second = map.insert(2);
+  if (!first || (first == second) || (*map.find(first) != 1) || (*map.find(second) != 2) || SlotHandle()) {
+    return EXIT_FAILURE;
+  }
+  // Erasing the first value moves the last into its place, which must not disturb the other handle
+  if (!map.erase(first) || map.erase(first) || map.contains(first) || (map.find(first) != nullptr) || (*map.find(second) != 2)) {
+    return EXIT_FAILURE;
+  }
+  // The slot is reused with a new generation
+  SlotHandle third = map.insert(3);
+  if ((third.index != first.index) || (third.generation == first.generation) || map.contains(first) || (*map.find(third) != 3)) {
+    return EXIT_FAILURE;
+  }
+  map.clear();
+  if (!map.empty() || map.contains(second) || map.contains(third)) {
     return EXIT_FAILURE;
   }
+  // Random operations against a model of the live values
+  vector<pair<SlotHandle,int>> live;
+  vector<SlotHandle> erased;
+  srand(25);
+  for (int i=0;i<100000;++i) {
+    if (live.empty() || (rand() % 3)) {
+      live.push_back(make_pair(map.insert(i),i));
+    } else {
+      size_t victim = rand() % live.size();
+      if (!map.erase(live[victim].first)) {
+        return EXIT_FAILURE;
+      }
+      erased.push_back(live[victim].first);
+      live[victim] = live.back();
+      live.pop_back();
+    }
+  }
+  long sum = 0;
+  for (size_t i=0;i<live.size();++i) {
+    const int *value = map.find(live[i].first);
+    if (!value || (*value != live[i].second)) {
+      return EXIT_FAILURE;
+    }
+    sum -= live[i].second;
+  }
+  for (size_t i=0;i<erased.size();++i) {
+    if (map.contains(erased[i])) {
+      return EXIT_FAILURE;
+    }
+  }
+  for (SlotMap<int>::iterator it=map.begin();it!=map.end();++it) {
+    sum += *it;
+  }
+  return ((map.size() == live.size()) && (sum == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-int destroyClient() {
-  client = new EchoClient(false);
-  if (client != nullptr) {
-    delete client;
-    return EXIT_SUCCESS;
+/** @brief Compares random adds, cancels and expiries on a TimerWheel against a model of the timers
+ *  @details Delays and steps of time span all four levels, so timers are cascaded down several times 
+ *           before they fire. next() must never be later than the earliest timer in the model. */
+int timerWheel() {
+  struct Timer {
+    uint64_t expiry;
+    uint64_t interval;
+    size_t key;
+  };
+  uint64_t now = 1000;
+  TimerWheel wheel(now);
+  map<TimerId,Timer> model;
+  vector<TimerId> dead;
+  vector<int> fired;
+  srand(6);
+  for (int i=0;i<10000;++i) {
+    switch (rand() % 6) {
+      case 0:
+      case 1:
+      case 2: {
+        uint64_t delay = 1 + (((uint64_t)rand() % 256) << (8 * (rand() % 4))) + rand() % 256;
+        uint64_t interval = (rand() % 4 == 0) ? 1 + rand() % 5000 : 0;
+        size_t key = fired.size();
+        fired.push_back(0);
+        TimerId id = wheel.add(now + delay,interval,[&fired,key]{ ++fired[key]; });
+        if (!id || model.count(id)) {
+          return EXIT_FAILURE;
+        }
+        model[id] = {now + delay,interval,key};
+        break;
+      }
+      case 3:
+        if (!model.empty()) {
+          map<TimerId,Timer>::iterator it = model.begin();
+          advance(it,rand() % model.size());
+          if (!wheel.cancel(it->first)) {
+            return EXIT_FAILURE;
+          }
+          dead.push_back(it->first);
+          model.erase(it);
+        }
+        if (!dead.empty() && wheel.cancel(dead[rand() % dead.size()])) {
+          return EXIT_FAILURE;
+        }
+        break;
+      default: {
+        now += ((uint64_t)rand() % 256) << (8 * (rand() % 3));
+        vector<shared_ptr<TimerCallback>> expired;
+        wheel.expire(now,expired);
+        for (size_t j=0;j<expired.size();++j) {
+          (*expired[j])();
+        }
+        map<TimerId,Timer>::iterator it = model.begin();
+        while (it != model.end()) {
+          Timer &timer = it->second;
+          if (fired[timer.key] != ((timer.expiry <= now) ? 1 : 0)) {
+            return EXIT_FAILURE;
+          }
+          fired[timer.key] = 0;
+          if (timer.expiry > now) {
+            ++it;
+          } else if (timer.interval) {
+            // A periodic timer that fell behind fires once and is rescheduled from now
+            timer.expiry += timer.interval;
+            if (timer.expiry <= now) {
+              timer.expiry = now + timer.interval;
+            }
+            ++it;
+          } else {
+            dead.push_back(it->first);
+            it = model.erase(it);
+          }
+        }
+      }
+    }
+    uint64_t earliest = TimerWheel::NEVER;
+    for (map<TimerId,Timer>::iterator it=model.begin();it!=model.end();++it) {
+      earliest = min(earliest,it->second.expiry);
+    }
+    if ((wheel.size() != model.size()) || (wheel.next() > earliest) || (model.empty() != (wheel.next() == TimerWheel::NEVER))) {
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+/** @brief Posts tasks to epoll from another thread while the polling thread is blocked in poll()
+ *  @details The eventfd must wake poll() long before its timeout, and the tasks must run on the polling
+ *           thread in the order they were posted, including a move only task and one posted by a task. */
+bool postTasks(EPoll &epoll) {
+  const int count = 3000;
+  vector<int> order;
+  bool sameThread = true;
+  thread::id polling = this_thread::get_id();
+  thread poster([&]{
+    this_thread::sleep_for(chrono::milliseconds(50));
+    for (int i=0;i<count;++i) {
+      epoll.post([&,i]{
+        order.push_back(i);
+        sameThread = sameThread && (this_thread::get_id() == polling);
+      });
+    }
+    unique_ptr<int> last(new int(count));
+    epoll.post([&,last = std::move(last)]{
+      epoll.post([&,value = *last]{ order.push_back(value); });
+    });
+  });
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  while ((order.size() <= (size_t)count) && (chrono::steady_clock::now() - start < chrono::seconds(5))) {
+    epoll.poll(5000);
+  }
+  bool result = (chrono::steady_clock::now() - start < chrono::seconds(2));
+  poster.join();
+  for (int i=0;result && (i <= count);++i) {
+    result = (order[i] == i);
+  }
+  return result && sameThread;
+}
+
+int postWake() {
+  EPoll epoll;
+  EPoll ring(EPollBackend::IO_URING);
+  return (postTasks(epoll) && postTasks(ring)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief A client that records the bytes it receives */
+class StreamRecorder : public Client {
+  public:
+    StreamRecorder(EPoll &epoll) : Client(epoll,nullptr) {}
+    vector<uint8_t> stream;
+  protected:
+    void dataAvailable() override {
+      uint8_t buffer[65536];
+      size_t size;
+      while ((size = read(buffer,sizeof(buffer))) > 0) {
+        stream.insert(stream.end(),buffer,buffer + size);
+      }
+    }
+};
+
+/** @brief Sends size random bytes through an EchoServer and checks that they return intact
+ *  @details The client is polled on epoll. If threads is not 0, the sessions run on an EPollPool of 
+ *           that size with the same backend and mode as epoll. */
+bool echoTransfer(EPoll &epoll, in_port_t port, size_t size, size_t threads = 0) {
+  EchoServer server(epoll,nullptr);
+  if (threads) {
+    server.setThreads(threads);
+  }
+  server.start(port,string("127.0.0.1"));
+  StreamRecorder client(epoll);
+  client.connect("127.0.0.1",to_string(port).c_str());
+  vector<uint8_t> data(size);
+  for (size_t i=0;i<size;++i) {
+    data[i] = (uint8_t)rand();
+  }
+  bool result = pollUntil(epoll,[&]{ return client.state() == SocketState::CONNECTED; }) &&
+                (client.write(data.data(),data.size()) == size) &&
+                pollUntil(epoll,[&]{ return client.stream.size() >= size; }) && (client.stream == data);
+  client.disconnect();
+  server.stop();
+  return result;
+}
+
+/** @brief Echoes data on an edge triggered instance, including data sent before the session was accepted */
+int edgeTriggeredEcho() {
+  EPoll epoll(EPollBackend::EPOLL,true);
+  EchoServer server(epoll,nullptr);
+  server.start(1230,string("127.0.0.1"));
+  // The only edge for this data is reported while the connection is still in the backlog
+  int fd = connectTo(1230);
+  string sent = "sent before accept";
+  string echoed;
+  bool result = (fd != -1) && (::write(fd,sent.data(),sent.size()) == (ssize_t)sent.size());
+  result = result && pollUntil(epoll,[&]{
+    char buffer[64];
+    ssize_t size = ::recv(fd,buffer,sizeof(buffer),MSG_DONTWAIT);
+    if (size > 0) {
+      echoed.append(buffer,size);
+    }
+    return echoed.size() >= sent.size();
+  }) && (echoed == sent);
+  ::close(fd);
+  server.stop();
+  srand(4);
+  result = result && echoTransfer(epoll,1231,4194304) && echoTransfer(epoll,1232,4194304,2);
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Echoes data on an io_uring instance, with sessions on the polling thread and on a pool
+ *  @details Requests for pooled sessions are queued by the thread that accepted them. The instance falls
+ *           back to epoll where io_uring is not available. */
+int ioUringEcho() {
+  EPoll epoll(EPollBackend::IO_URING);
+  srand(3);
+  bool result = echoTransfer(epoll,1235,4194304) && echoTransfer(epoll,1236,4194304,2);
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Echoes a transfer large enough for the reads to grow to their largest readv() size */
+int largeTransfer() {
+  EPoll epoll;
+  srand(11);
+  return echoTransfer(epoll,1240,16777216) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int zeroCopyFreed = 0;
+size_t zeroCopyPinned = 0;
+
+/** @brief A session that answers the first byte with 4 MiB sent by MSG_ZEROCOPY, then disconnects */
+class ZeroCopySession : public Session {
+  public:
+    ZeroCopySession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {
+      setZeroCopy(4096);
+      // Send before disconnect() rather than at the end of the poll
+      setFlushPolicy(FlushPolicy::WRITE_THROUGH);
+    }
+    ~ZeroCopySession() { ++zeroCopyFreed; }
+  protected:
+    void dataAvailable() override {
+      uint8_t seed;
+      if (read(&seed,1) == 1) {
+        vector<uint8_t> data(4194304);
+        for (size_t i=0;i<data.size();++i) {
+          data[i] = (uint8_t)(i * 7 + seed);
+        }
+        write(data.data(),data.size());
+        zeroCopyPinned = zeroCopyPending();
+        disconnect();
+      }
+    }
+};
+
+/** @brief Checks that a session destroyed with zerocopy sends in flight is freed after they complete
+ *  @details The session disconnects while the small receive buffer of the client holds up the sends. 
+ *           Every byte received must match, and the session must be freed once the client has read
+ *           everything. A second session, whose client reads nothing, must be freed by Server::stop(). */
+int zeroCopyLinger() {
+  EPoll epoll;
+  TestServer<ZeroCopySession> server(epoll);
+  server.start(1245,string("127.0.0.1"));
+  int fd = connectTo(1245);
+  int size = 65536;
+  setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+  zeroCopyFreed = 0;
+  uint8_t seed = 42;
+  vector<uint8_t> stream;
+  bool closed = false;
+  bool result = (fd != -1) && (::write(fd,&seed,1) == 1) && pollUntil(epoll,[&]{
+    uint8_t buffer[65536];
+    ssize_t size = ::recv(fd,buffer,sizeof(buffer),MSG_DONTWAIT);
+    if (size > 0) {
+      stream.insert(stream.end(),buffer,buffer + size);
+    }
+    closed = closed || (size == 0);
+    return closed && (zeroCopyFreed == 1);
+  });
+  result = result && (zeroCopyPinned > 0) && !stream.empty();
+  for (size_t i=0;result && (i < stream.size());++i) {
+    result = (stream[i] == (uint8_t)(i * 7 + seed));
+  }
+  ::close(fd);
+  server.stop();
+  // A session that is still waiting when the server stops is closed by stop()
+  TestServer<ZeroCopySession> stopped(epoll);
+  stopped.start(1246,string("127.0.0.1"));
+  fd = connectTo(1246);
+  setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+  zeroCopyFreed = 0;
+  zeroCopyPinned = 0;
+  result = result && (fd != -1) && (::write(fd,&seed,1) == 1) && pollUntil(epoll,[&]{ return zeroCopyPinned > 0; }) &&
+           (zeroCopyFreed == 0);
+  stopped.stop();
+  result = result && (zeroCopyFreed == 1) && (epoll.size() == 0);
+  ::close(fd);
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Accepts a backlog of connections a few at a time on both level and edge triggered instances
+ *  @details An edge triggered listener ignores the batch size and drains the backlog, because it would
+ *           not be notified about the remaining connections. */
+bool acceptBacklog(EPoll &epoll, in_port_t port) {
+  EchoServer server(epoll,nullptr);
+  server.setAcceptBatch(3);
+  server.start(port,string("127.0.0.1"));
+  vector<int> fds;
+  for (int i=0;i<50;++i) {
+    fds.push_back(connectTo(port));
+  }
+  bool result = (find(fds.begin(),fds.end(),-1) == fds.end()) && pollUntil(epoll,[&]{ return epoll.size() == 51; });
+  for (size_t i=0;i<fds.size();++i) {
+    ::close(fds[i]);
+  }
+  result = result && pollUntil(epoll,[&]{ return epoll.size() == 1; });
+  server.stop();
+  return result;
+}
+
+int acceptBatch() {
+  EPoll levelTriggered;
+  EPoll edgeTriggered(EPollBackend::EPOLL,true);
+  bool result = acceptBacklog(levelTriggered,1250) && acceptBacklog(edgeTriggered,1251);
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+atomic<int> workerFreed(0);
+
+/** @brief A session on a worker pool that disconnects from the worker once 64 KiB have arrived */
+class WorkerDestroySession : public Session {
+  public:
+    WorkerDestroySession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {}
+    ~WorkerDestroySession() { ++workerFreed; }
+  protected:
+    void dataAvailable() override {
+      uint8_t buffer[16384];
+      mtx.lock();
+      while ((received_ < 65536) && (read(buffer,sizeof(buffer)) > 0)) {
+        received_ += sizeof(buffer);
+      }
+      bool done = (received_ >= 65536) && connected();
+      mtx.unlock();
+      if (done) {
+        disconnect();
+      }
+    }
+  private:
+    size_t received_ {0};
+};
+
+/** @brief Destroys sessions from worker threads while their peers are still sending
+ *  @details The polling thread keeps dispatching events to a session that a worker is destroying, so
+ *           each session must be released exactly once. */
+int workerDestroy() {
+  EPoll epoll;
+  TestServer<WorkerDestroySession> server(epoll);
+  server.setWorkers(4);
+  server.start(1255,string("127.0.0.1"));
+  workerFreed = 0;
+  vector<uint8_t> data(4096,'x');
+  bool result = true;
+  for (int round=0;result && (round < 100);++round) {
+    vector<int> fds;
+    for (int i=0;i<20;++i) {
+      fds.push_back(connectTo(1255));
+    }
+    result = (find(fds.begin(),fds.end(),-1) == fds.end()) && pollUntil(epoll,[&]{
+      for (size_t i=0;i<fds.size();++i) {
+        ::send(fds[i],data.data(),data.size(),MSG_DONTWAIT | MSG_NOSIGNAL);
+      }
+      return workerFreed == (round + 1) * 20;
+    });
+    for (size_t i=0;i<fds.size();++i) {
+      ::close(fds[i]);
+    }
+  }
+  result = result && pollUntil(epoll,[&]{ return server.sessionCount() == 0; }) && (workerFreed == 2000);
+  server.stop();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief A session that leaves its output corked between the byte 'a' and the byte 'b'
+ *  @details The reply to 'a' is flushed at the end of the poll while the socket is corked, so it is sent
+ *           with MSG_MORE and nothing is left to send when 'b' uncorks the socket. */
+class UncorkSession : public Session {
+  public:
+    UncorkSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {
+      setFlushPolicy(FlushPolicy::END_OF_LOOP);
+    }
+  protected:
+    void dataAvailable() override {
+      uint8_t byte;
+      while (read(&byte,1) == 1) {
+        if (byte == 'a') {
+          string reply(100,'r');
+          write(reply.data(),reply.size());
+          cork();
+        } else if (byte == 'b') {
+          uncork();
+        }
+      }
+    }
+};
+
+/** @brief Checks that the last uncork() pushes data that was already sent with MSG_MORE */
+int uncorkLatency() {
+  EPoll epoll;
+  TestServer<UncorkSession> server(epoll);
+  server.start(1260,string("127.0.0.1"));
+  int fd = connectTo(1260);
+  size_t count = 0;
+  auto receive = [&]{
+    char buffer[256];
+    ssize_t size = ::recv(fd,buffer,sizeof(buffer),MSG_DONTWAIT);
+    count += (size > 0) ? size : 0;
+    return count >= 100;
+  };
+  bool result = (fd != -1) && (::write(fd,"a",1) == 1);
+  // Give the reply time to be held back by the kernel
+  chrono::steady_clock::time_point limit = chrono::steady_clock::now() + chrono::milliseconds(50);
+  while (result && (chrono::steady_clock::now() < limit)) {
+    epoll.poll(10);
+  }
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  result = result && (::write(fd,"b",1) == 1) && pollUntil(epoll,receive);
+  result = result && (chrono::steady_clock::now() - start < chrono::milliseconds(100));
+  ::close(fd);
+  server.stop();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Returns the number of sockets registered with each EPoll instance of pool */
+vector<size_t> poolSizes(EPollPool &pool) {
+  vector<size_t> result;
+  for (size_t i=0;i<pool.size();++i) {
+    result.push_back(pool[i].size());
+  }
+  return result;
+}
+
+/** @brief Spreads connections over a server with three threads, then replaces two on the first instance
+ *  @details Nine connections are opened one at a time, so both policies place connection i on instance
+ *           i % 3. Closing connections 0 and 3 empties the first instance by two. LEAST_CONNECTIONS must
+ *           refill it, while ROUND_ROBIN carries on from where it was. */
+bool balance(EPoll &epoll, in_port_t port, BalancePolicy policy, const vector<size_t> &expected) {
+  EchoServer server(epoll,nullptr);
+  server.setThreads(3,policy);
+  server.start(port,string("127.0.0.1"));
+  EPollPool &pool = *server.pool();
+  auto total = [&]{ vector<size_t> sizes = poolSizes(pool); return sizes[0] + sizes[1] + sizes[2]; };
+  vector<int> fds;
+  bool result = true;
+  for (size_t i=0;result && (i < 9);++i) {
+    fds.push_back(connectTo(port));
+    result = (fds.back() != -1) && pollUntil(epoll,[&]{ return total() == i + 1; });
+  }
+  result = result && (poolSizes(pool) == vector<size_t>({3,3,3}));
+  ::close(fds[0]);
+  ::close(fds[3]);
+  result = result && pollUntil(epoll,[&]{ return pool[0].size() == 1; });
+  for (size_t i=0;result && (i < 2);++i) {
+    fds[i * 3] = connectTo(port);
+    result = (fds[i * 3] != -1) && pollUntil(epoll,[&]{ return total() == 8 + i; });
+  }
+  result = result && (poolSizes(pool) == expected);
+  for (size_t i=0;i<fds.size();++i) {
+    ::close(fds[i]);
+  }
+  server.stop();
+  return result;
+}
+
+/** @brief Checks the order in which each policy selects EPoll instances from a pool */
+int balancePolicy() {
+  EPollPool pool(3);
+  bool result = true;
+  for (size_t i=0;result && (i < 6);++i) {
+    result = (&pool.select(BalancePolicy::ROUND_ROBIN) == &pool[i % 3]) && (&pool.select(BalancePolicy::LEAST_CONNECTIONS) == &pool[0]);
+  }
+  EPoll epoll;
+  result = result && balance(epoll,1265,BalancePolicy::LEAST_CONNECTIONS,{3,3,3}) && balance(epoll,1266,BalancePolicy::ROUND_ROBIN,{2,4,3});
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Opens count connections to a sharded server and echoes a message on each of them
+ *  @details Returns the number of sockets then registered with each EPoll instance of its pool */
+vector<size_t> shardedEcho(EPoll &epoll, EchoServer &server, in_port_t port, size_t count) {
+  EPollPool &pool = *server.pool();
+  vector<size_t> sizes;
+  vector<int> fds;
+  bool result = true;
+  for (size_t i=0;result && (i < count);++i) {
+    fds.push_back(connectTo(port));
+    char reply[5];
+    result = (fds.back() != -1) && (::write(fds.back(),"shard",5) == 5) && (::recv(fds.back(),reply,5,MSG_WAITALL) == 5) &&
+             (memcmp(reply,"shard",5) == 0);
+  }
+  if (result) {
+    sizes = poolSizes(pool);
+  }
+  for (size_t i=0;i<fds.size();++i) {
+    ::close(fds[i]);
+  }
+  // The server socket is never registered, so the connections must have been accepted by the Listeners
+  result = result && (epoll.size() == 0);
+  return result ? sizes : vector<size_t>();
+}
+
+/** @brief Starts sharded servers with and without CPU steering, and one whose listeners cannot all start
+ *  @details Each Listener accepts onto its own thread. With steering, connections made from CPU 0 must all
+ *           be accepted by the first Listener. A server that runs out of file handles part way through
+ *           starting its Listeners must fail to start and leave nothing running. */
+int shardedListeners() {
+  EPoll epoll;
+  bool result;
+  {
+    EchoServer server(epoll,nullptr);
+    server.setThreads(3);
+    server.setSharding(true);
+    result = server.start(1270,string("127.0.0.1"));
+    vector<size_t> sizes = shardedEcho(epoll,server,1270,30);
+    result = result && (sizes.size() == 3) && (sizes[0] + sizes[1] + sizes[2] == 33);
+    server.stop();
+  }
+  {
+    cpu_set_t saved, first;
+    sched_getaffinity(0,sizeof(saved),&saved);
+    CPU_ZERO(&first);
+    CPU_SET(0,&first);
+    sched_setaffinity(0,sizeof(first),&first);
+    EchoServer server(epoll,nullptr);
+    server.setThreads(3);
+    server.setSharding(true,true);
+    result = result && server.start(1271,string("127.0.0.1"));
+    result = result && (shardedEcho(epoll,server,1271,10) == vector<size_t>({11,1,1}));
+    server.stop();
+    sched_setaffinity(0,sizeof(saved),&saved);
+  }
+  {
+    EchoServer server(epoll,nullptr);
+    server.setThreads(3);
+    server.setSharding(true);
+    // Leave room for one Listener
+    int next = ::dup(0);
+    ::close(next);
+    struct rlimit saved, limit;
+    getrlimit(RLIMIT_NOFILE,&saved);
+    limit = saved;
+    limit.rlim_cur = next + 1;
+    setrlimit(RLIMIT_NOFILE,&limit);
+    bool started = server.start(1272,string("127.0.0.1"));
+    setrlimit(RLIMIT_NOFILE,&saved);
+    result = result && !started && !server.listening() && !server.pool()->running() && (poolSizes(*server.pool()) == vector<size_t>({0,0,0}));
+    server.stop();
+  }
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+SharedBuffer broadcast;
+
+/** @brief A session that sends broadcast to its peer once the peer sends a byte */
+class BroadcastSession : public Session {
+  public:
+    BroadcastSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {}
+  protected:
+    void dataAvailable() override {
+      if (consume(available()) > 0) {
+        write(broadcast);
+      }
+    }
+};
+
+/** @brief Checks slicing and sharing of SharedBuffers, and appending them to ByteBuffers and sessions
+ *  @details Random slices are appended by reference to a ByteBuffer with small blocks, mixed with bytes
+ *           that are copied in, and must read back like a model without the shared memory being written.
+ *           Copies are then released on several threads at once. Finally one SharedBuffer is sent to 
+ *           several sessions. */
+int sharedBuffer() {
+  vector<uint8_t> source(100000);
+  for (size_t i=0;i<source.size();++i) {
+    source[i] = (uint8_t)(i * 13);
+  }
+  vector<uint8_t> original = source;
+  const uint8_t *memory = source.data();
+  SharedBuffer shared(std::move(source));
+  SharedBuffer small(original.data(),10);
+  bool result = (shared.data() == memory) && (shared.size() == 100000) && SharedBuffer().empty() &&
+                (shared.slice(1000,50000).data() == memory + 1000) && (shared.slice(1000,50000).size() == 50000) &&
+                (shared.slice(90000,50000).size() == 10000) && shared.slice(200000).empty() &&
+                (shared.slice(1000).slice(10,10).data() == memory + 1010) &&
+                (small.data() != original.data()) && equal(small.data(),small.data() + 10,original.begin());
+  ByteBuffer buffer(64);
+  deque<uint8_t> model;
+  vector<uint8_t> data(5000);
+  srand(12);
+  for (int i=0;result && (i < 5000);++i) {
+    size_t size = rand() % data.size();
+    switch (rand() % 4) {
+      case 0: {
+        size_t offset = rand() % original.size();
+        buffer.append(shared.slice(offset,size));
+        model.insert(model.end(),original.begin() + offset,original.begin() + min(offset + size,original.size()));
+        break;
+      }
+      case 1:
+        for (size_t j=0;j<size % 200;++j) {
+          data[j] = (uint8_t)rand();
+        }
+        buffer.append(data.data(),size % 200);
+        model.insert(model.end(),data.begin(),data.begin() + size % 200);
+        break;
+      case 2: {
+        struct iovec iov[32];
+        size_t count = buffer.reserve(size % 200,iov,32);
+        size_t written = 0;
+        for (size_t j=0;j<count;++j) {
+          memset(iov[j].iov_base,0xEE,iov[j].iov_len);
+          written += iov[j].iov_len;
+        }
+        written = min(written,size % 200);
+        buffer.commit(written);
+        model.insert(model.end(),written,0xEE);
+        break;
+      }
+      case 3: {
+        size_t read = buffer.read(data.data(),size);
+        result = (read == min(size,model.size())) && equal(data.begin(),data.begin() + read,model.begin());
+        model.erase(model.begin(),model.begin() + read);
+        break;
+      }
+    }
+    result = result && (buffer.size() == model.size());
+  }
+  buffer.clear();
+  result = result && equal(original.begin(),original.end(),memory);
+  // Copies of the same buffer are made and released concurrently
+  vector<thread> threads;
+  for (int i=0;i<4;++i) {
+    threads.push_back(thread([&]{
+      for (int j=0;j<100000;++j) {
+        SharedBuffer copy = shared.slice(j % 1000);
+      }
+    }));
+  }
+  for (size_t i=0;i<threads.size();++i) {
+    threads[i].join();
+  }
+  result = result && (shared.data() == memory) && equal(original.begin(),original.end(),shared.data());
+  // One buffer is sent to every session
+  broadcast = shared;
+  EPoll epoll;
+  TestServer<BroadcastSession> server(epoll);
+  server.start(1275,string("127.0.0.1"));
+  vector<int> fds;
+  vector<vector<uint8_t>> streams(4);
+  for (size_t i=0;i<streams.size();++i) {
+    fds.push_back(connectTo(1275));
+    result = result && (fds.back() != -1) && (::write(fds.back(),"?",1) == 1);
+  }
+  result = result && pollUntil(epoll,[&]{
+    bool done = true;
+    for (size_t i=0;i<fds.size();++i) {
+      uint8_t chunk[65536];
+      ssize_t size = ::recv(fds[i],chunk,sizeof(chunk),MSG_DONTWAIT);
+      if (size > 0) {
+        streams[i].insert(streams[i].end(),chunk,chunk + size);
+      }
+      done = done && (streams[i].size() >= original.size());
+    }
+    return done;
+  });
+  for (size_t i=0;i<fds.size();++i) {
+    result = result && (streams[i] == original);
+    ::close(fds[i]);
+  }
+  server.stop();
+  broadcast = SharedBuffer();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+size_t viewContiguous = 0;
+size_t viewSplit = 0;
+
+/** @brief A session that echoes 100 byte records from views of the inputBuffer without copying them out */
+class RecordViewSession : public Session {
+  public:
+    RecordViewSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {}
+  protected:
+    void dataAvailable() override {
+      while (available() >= 100) {
+        const uint8_t *record = view(100);
+        if (record) {
+          write(record,100);
+          ++viewContiguous;
+        } else {
+          // The record spans two blocks
+          struct iovec iov[8];
+          size_t count = view(iov,8,100);
+          for (size_t i=0;i<count;++i) {
+            write(iov[i].iov_base,iov[i].iov_len);
+          }
+          ++viewSplit;
+        }
+        consume(100);
+      }
+    }
+};
+
+/** @brief Checks contiguous() and iovecs() against a model, then echoes records through views
+ *  @details Records straddle the blocks of the inputBuffer, so the session must see both contiguous 
+ *           records and records split across blocks. */
+int viewConsume() {
+  ByteBuffer buffer(64);
+  deque<uint8_t> model;
+  vector<uint8_t> data(1000);
+  srand(13);
+  bool result = true;
+  for (int i=0;result && (i < 20000);++i) {
+    size_t size = rand() % data.size();
+    switch (rand() % 4) {
+      case 0:
+        for (size_t j=0;j<size;++j) {
+          data[j] = (uint8_t)rand();
+        }
+        buffer.append(data.data(),size);
+        model.insert(model.end(),data.begin(),data.begin() + size);
+        break;
+      case 1: {
+        size_t consumed = buffer.consume(size);
+        result = (consumed == min(size,model.size()));
+        model.erase(model.begin(),model.begin() + consumed);
+        break;
+      }
+      case 2: {
+        size %= 100;
+        const uint8_t *view = buffer.contiguous(size);
+        result = (size > model.size()) ? !view : (!view || equal(view,view + size,model.begin()));
+        // A single byte is always contiguous
+        result = result && (view || (size != 1) || model.empty());
+        break;
+      }
+      case 3: {
+        struct iovec iov[8];
+        size_t count = buffer.iovecs(iov,8,size);
+        size_t total = 0;
+        for (size_t j=0;result && (j < count);++j) {
+          result = (iov[j].iov_len > 0) && equal((uint8_t*)iov[j].iov_base,(uint8_t*)iov[j].iov_base + iov[j].iov_len,model.begin() + total);
+          total += iov[j].iov_len;
+        }
+        result = result && (count <= 8) && (total <= min(size,model.size())) && ((count == 8) || (total == min(size,model.size())));
+        break;
+      }
+    }
+    result = result && (buffer.size() == model.size());
+  }
+  EPoll epoll;
+  TestServer<RecordViewSession> server(epoll);
+  server.start(1280,string("127.0.0.1"));
+  StreamRecorder client(epoll);
+  client.connect("127.0.0.1","1280");
+  vector<uint8_t> records(1000000);
+  for (size_t i=0;i<records.size();++i) {
+    records[i] = (uint8_t)rand();
+  }
+  result = result && pollUntil(epoll,[&]{ return client.state() == SocketState::CONNECTED; });
+  for (size_t sent=0;result && (sent < records.size());) {
+    size_t size = min<size_t>(1 + rand() % 30000,records.size() - sent);
+    result = (client.write(records.data() + sent,size) == size);
+    sent += size;
+    epoll.poll(0);
+  }
+  result = result && pollUntil(epoll,[&]{ return client.stream.size() >= records.size(); }) && (client.stream == records) &&
+           (viewContiguous > 0) && (viewSplit > 0);
+  client.disconnect();
+  server.stop();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/** @brief Fills a BlockPool to its limit, returns every block from other threads and takes them back
+ *  @details The owner keeps allocating while four threads release the blocks, so each allocation races the
+ *           returns it reclaims. Every block must come back exactly once, and the pool must be empty and
+ *           unmapped after trim(). Allocations on a thread without a Scope are left to the heap. */
+int blockPool() {
+  BlockPool pool(16384);
+  pool.setLimit(4 * BlockPool::SLAB_SIZE);
+  bool result = !pool.owned() && !pool.allocate();
+  BlockPool::Scope scope(pool);
+  vector<void*> blocks;
+  void *block;
+  while ((block = pool.allocate())) {
+    memset(block,(int)(blocks.size() % 251),pool.size());
+    blocks.push_back(block);
+  }
+  BlockPoolStats stats = pool.stats();
+  result = result && pool.owned() && (blocks.size() > 400) && (stats.bytesHeld == pool.limit()) && (stats.bytesInUse >= blocks.size() * pool.size());
+  atomic<bool> failed(false);
+  vector<thread> threads;
+  for (size_t t=0;t<4;++t) {
+    threads.push_back(thread([&,t]{
+      if (pool.allocate()) {
+        failed = true;
+      }
+      for (size_t i=t;i<blocks.size();i+=4) {
+        const uint8_t *data = (const uint8_t*)blocks[i];
+        if ((data[0] != i % 251) || (data[pool.size() - 1] != i % 251)) {
+          failed = true;
+        }
+        pool.release(blocks[i]);
+      }
+    }));
+  }
+  vector<void*> reclaimed;
+  chrono::steady_clock::time_point limit = chrono::steady_clock::now() + chrono::seconds(5);
+  while ((reclaimed.size() < blocks.size()) && (chrono::steady_clock::now() < limit)) {
+    if ((block = pool.allocate())) {
+      reclaimed.push_back(block);
+    }
+  }
+  for (size_t i=0;i<threads.size();++i) {
+    threads[i].join();
+  }
+  sort(blocks.begin(),blocks.end());
+  sort(reclaimed.begin(),reclaimed.end());
+  result = result && !failed && (reclaimed == blocks) && !pool.allocate() && (pool.stats().bytesHeld == pool.limit());
+  for (size_t i=0;i<reclaimed.size();++i) {
+    pool.release(reclaimed[i]);
+  }
+  pool.trim();
+  stats = pool.stats();
+  return (result && (stats.bytesInUse == 0) && (stats.bytesHeld == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int sendFileHandle = -1;
+int sendFileRequests = 0;
+vector<int> sendFileResults;
+
+/** @brief A session that answers a byte with data written around two regions of sendFileHandle
+ *  @details The regions are 1 MiB at offset 100 and 2 MiB at offset 1 MiB. Each callback records the 
+ *           region number if it succeeded, or its negation if it failed. */
+class FileSession : public Session {
+  public:
+    FileSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {
+      int size = 65536;
+      setsockopt(socket,SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
+    }
+  protected:
+    void dataAvailable() override {
+      if (consume(available()) > 0) {
+        ++sendFileRequests;
+        write("head",4);
+        sendFile(sendFileHandle,100,1048576,[](bool sent){ sendFileResults.push_back(sent ? 1 : -1); });
+        write("middle",6);
+        sendFile(sendFileHandle,1048576,2097152,[](bool sent){ sendFileResults.push_back(sent ? 2 : -2); });
+        write("tail",4);
+      }
+    }
+};
+
+/** @brief Requests the file regions of a FileSession and checks the stream and the callbacks
+ *  @details The socket buffers are kept small so that the regions are sent across several writable
+ *           events. If abandon is true the client closes without reading, and both callbacks must 
+ *           report failure. */
+bool fileRegions(EPoll &epoll, in_port_t port, const vector<uint8_t> &file, bool abandon) {
+  TestServer<FileSession> server(epoll);
+  server.start(port,string("127.0.0.1"));
+  vector<uint8_t> expected;
+  expected.insert(expected.end(),{'h','e','a','d'});
+  expected.insert(expected.end(),file.begin() + 100,file.begin() + 100 + 1048576);
+  expected.insert(expected.end(),{'m','i','d','d','l','e'});
+  expected.insert(expected.end(),file.begin() + 1048576,file.begin() + 3145728);
+  expected.insert(expected.end(),{'t','a','i','l'});
+  sendFileRequests = 0;
+  sendFileResults.clear();
+  int fd = connectTo(port);
+  int size = 65536;
+  setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+  vector<uint8_t> stream;
+  bool result = (fd != -1) && (::write(fd,"?",1) == 1);
+  if (abandon) {
+    result = result && pollUntil(epoll,[&]{ return sendFileRequests == 1; });
+    ::close(fd);
+    result = result && pollUntil(epoll,[&]{ return sendFileResults.size() == 2; }) && (sendFileResults == vector<int>({-1,-2}));
   } else {
-    return EXIT_FAILURE;
+    result = result && pollUntil(epoll,[&]{
+      uint8_t chunk[65536];
+      ssize_t size = ::recv(fd,chunk,sizeof(chunk),MSG_DONTWAIT);
+      if (size > 0) {
+        stream.insert(stream.end(),chunk,chunk + size);
+      }
+      return (stream.size() >= expected.size()) && (sendFileResults.size() == 2);
+    }) && (stream == expected) && (sendFileResults == vector<int>({1,2}));
+    ::close(fd);
+  }
+  server.stop();
+  return result;
+}
+
+/** @brief Sends file regions between buffered writes with sendfile() and through an io_uring instance */
+int sendFileRegions() {
+  char name[] = "/tmp/tcpsendfileXXXXXX";
+  sendFileHandle = mkstemp(name);
+  unlink(name);
+  vector<uint8_t> file(3145728);
+  srand(16);
+  for (size_t i=0;i<file.size();++i) {
+    file[i] = (uint8_t)rand();
+  }
+  bool result = (sendFileHandle != -1) && (::write(sendFileHandle,file.data(),file.size()) == (ssize_t)file.size());
+  EPoll epoll;
+  EPoll ring(EPollBackend::IO_URING);
+  result = result && fileRegions(epoll,1285,file,false) && fileRegions(ring,1286,file,false) && fileRegions(epoll,1287,file,true);
+  ::close(sendFileHandle);
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+class WatermarkSession;
+WatermarkSession *watermarkSession = nullptr;
+int watermarkBlocked = 0;
+int watermarkDrained = 0;
+size_t watermarkPeak = 0;
+
+/** @brief An echo session with small socket buffers that stops reading while its output is blocked */
+class WatermarkSession : public Session {
+  public:
+    WatermarkSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {
+      int size = 65536;
+      setsockopt(socket,SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
+      setsockopt(socket,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+      setWatermarks(262144,65536);
+      setPauseOnWriteBlocked(true);
+      watermarkSession = this;
+    }
+    ~WatermarkSession() { watermarkSession = nullptr; }
+  protected:
+    void dataAvailable() override {
+      uint8_t buffer[65536];
+      size_t size;
+      while ((size = read(buffer,sizeof(buffer))) > 0) {
+        write(buffer,size);
+        watermarkPeak = max(watermarkPeak,bufferedAmount());
+      }
+    }
+    void onWriteBlocked() override { ++watermarkBlocked; }
+    void onWriteDrained() override { ++watermarkDrained; }
+};
+
+/** @brief Floods a WatermarkSession with a client that does not read, then reads everything back
+ *  @details The session must block and pause reading, so that its output stays near the high watermark
+ *           while TCP flow control stops the client. Once the client reads, the output must drain and
+ *           every byte must come back. Finally reading is paused and resumed from another thread. */
+bool watermarkEcho(EPoll &epoll, in_port_t port) {
+  TestServer<WatermarkSession> server(epoll);
+  server.start(port,string("127.0.0.1"));
+  watermarkBlocked = 0;
+  watermarkDrained = 0;
+  watermarkPeak = 0;
+  int fd = connectTo(port);
+  int size = 65536;
+  setsockopt(fd,SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
+  setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+  vector<uint8_t> data(8388608);
+  for (size_t i=0;i<data.size();++i) {
+    data[i] = (uint8_t)rand();
+  }
+  size_t sent = 0;
+  vector<uint8_t> stream;
+  auto send = [&]{
+    ssize_t size = ::send(fd,data.data() + sent,min<size_t>(65536,data.size() - sent),MSG_DONTWAIT);
+    sent += (size > 0) ? size : 0;
+    return size > 0;
+  };
+  auto receive = [&]{
+    uint8_t chunk[65536];
+    ssize_t size = ::recv(fd,chunk,sizeof(chunk),MSG_DONTWAIT);
+    if (size > 0) {
+      stream.insert(stream.end(),chunk,chunk + size);
+    }
+    return size > 0;
+  };
+  // Send until the client has made no progress for twenty polls
+  int stalled = 0;
+  bool result = (fd != -1) && pollUntil(epoll,[&]{
+    stalled = send() ? 0 : stalled + 1;
+    return stalled > 20;
+  });
+  result = result && watermarkSession && watermarkSession->writeBlocked() && watermarkSession->readingPaused() &&
+           (watermarkBlocked == 1) && (watermarkDrained == 0) && (sent < data.size()) && (watermarkPeak < 1048576);
+  result = result && pollUntil(epoll,[&]{
+    send();
+    receive();
+    return stream.size() >= data.size();
+  }) && (stream == data) && (watermarkBlocked >= 1) && (watermarkDrained == watermarkBlocked) && 
+       !watermarkSession->writeBlocked() && !watermarkSession->readingPaused();
+  // Pause and resume from a thread that does not poll the session
+  if (result) {
+    thread([]{ watermarkSession->pauseReading(true); }).join();
+    stream.clear();
+    chrono::steady_clock::time_point limit = chrono::steady_clock::now() + chrono::milliseconds(50);
+    result = (::write(fd,"paused",6) == 6);
+    while (chrono::steady_clock::now() < limit) {
+      epoll.poll(10);
+      receive();
+    }
+    result = result && stream.empty() && watermarkSession->readingPaused();
+    thread([]{ watermarkSession->pauseReading(false); }).join();
+    result = result && pollUntil(epoll,[&]{ receive(); return stream.size() >= 6; }) && (string(stream.begin(),stream.end()) == "paused");
+  }
+  ::close(fd);
+  server.stop();
+  return result;
+}
+
+int watermarks() {
+  EPoll levelTriggered;
+  EPoll edgeTriggered(EPollBackend::EPOLL,true);
+  srand(17);
+  return (watermarkEcho(levelTriggered,1290) && watermarkEcho(edgeTriggered,1291)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+class FlushSession;
+FlushSession *flushSession = nullptr;
+FlushPolicy flushPolicy = FlushPolicy::ON_WRITABLE;
+int flushPeer = -1;
+bool flushSeen = false;
+vector<uint8_t> flushBlob;
+
+/** @brief A session that replies to a byte, checks whether its peer can already read the reply, then sends flushBlob */
+class FlushSession : public Session {
+  public:
+    FlushSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {
+      int size = 65536;
+      setsockopt(socket,SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
+      setFlushPolicy(flushPolicy);
+      flushSession = this;
+    }
+    ~FlushSession() { flushSession = nullptr; }
+  protected:
+    void dataAvailable() override {
+      if (consume(available()) > 0) {
+        write("now",3);
+        char reply[3];
+        flushSeen = (::recv(flushPeer,reply,sizeof(reply),MSG_PEEK | MSG_DONTWAIT) == 3);
+        write(flushBlob.data(),flushBlob.size());
+      }
+    }
+};
+
+/** @brief Checks when the writes of a FlushSession reach its peer under the given policy
+ *  @details Under WRITE_THROUGH the reply must be readable before write() returns, the part of the blob
+ *           that does not fit in the socket buffers must follow on EPOLLOUT, and a write from a thread that
+ *           does not poll the session must be sent by that thread. Under ON_WRITABLE none of that is sent
+ *           until the socket is polled. */
+bool flushTiming(EPoll &epoll, in_port_t port, FlushPolicy policy) {
+  flushPolicy = policy;
+  TestServer<FlushSession> server(epoll);
+  server.start(port,string("127.0.0.1"));
+  flushPeer = connectTo(port);
+  flushSeen = false;
+  vector<uint8_t> expected = {'n','o','w'};
+  expected.insert(expected.end(),flushBlob.begin(),flushBlob.end());
+  vector<uint8_t> stream;
+  bool result = (flushPeer != -1) && (::write(flushPeer,"?",1) == 1) && pollUntil(epoll,[&]{
+    uint8_t chunk[65536];
+    ssize_t size = ::recv(flushPeer,chunk,sizeof(chunk),MSG_DONTWAIT);
+    if (size > 0) {
+      stream.insert(stream.end(),chunk,chunk + size);
+    }
+    return stream.size() >= expected.size();
+  }) && (stream == expected) && (flushSeen == (policy == FlushPolicy::WRITE_THROUGH));
+  if (result) {
+    thread([]{ flushSession->write("thread",6); }).join();
+    char reply[6];
+    ssize_t size = ::recv(flushPeer,reply,sizeof(reply),MSG_DONTWAIT);
+    result = (policy == FlushPolicy::WRITE_THROUGH) ? ((size == 6) && (memcmp(reply,"thread",6) == 0)) : (size == -1);
+  }
+  ::close(flushPeer);
+  server.stop();
+  return result;
+}
+
+int writeThrough() {
+  EPoll epoll;
+  flushBlob.resize(4194304);
+  srand(19);
+  for (size_t i=0;i<flushBlob.size();++i) {
+    flushBlob[i] = (uint8_t)rand();
+  }
+  bool result = flushTiming(epoll,1295,FlushPolicy::WRITE_THROUGH) && flushTiming(epoll,1296,FlushPolicy::ON_WRITABLE);
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+class LoopSession;
+LoopSession *loopSession = nullptr;
+int loopPeer = -1;
+int loopRequests = 0;
+bool loopSeen = false;
+
+/** @brief An END_OF_LOOP session that answers 'w' with a hundred small writes and 'q' with a write and disconnect() */
+class LoopSession : public Session {
+  public:
+    LoopSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {
+      setFlushPolicy(FlushPolicy::END_OF_LOOP);
+      loopSession = this;
+    }
+    ~LoopSession() { loopSession = nullptr; }
+  protected:
+    void dataAvailable() override {
+      char request;
+      while (read(&request,1) == 1) {
+        ++loopRequests;
+        for (int i=0;i<100;++i) {
+          write("0123456789",10);
+        }
+        char reply[1];
+        loopSeen = (::recv(loopPeer,reply,sizeof(reply),MSG_PEEK | MSG_DONTWAIT) > 0);
+        if (request == 'q') {
+          disconnect();
+          return;
+        }
+      }
+    }
+};
+
+/** @brief Checks that END_OF_LOOP output is sent once poll() has handled the events, and not before
+ *  @details Output written on the polling thread must reach the peer by the time poll() returns. Output
+ *           written on another thread waits for the task that poll() runs. A session that disconnects 
+ *           while it is in the dirty list must still be freed. */
+int endOfLoop() {
+  EPoll epoll;
+  TestServer<LoopSession> server(epoll);
+  server.start(1297,string("127.0.0.1"));
+  loopPeer = connectTo(1297);
+  auto pending = []{
+    char buffer[2048];
+    ssize_t size = ::recv(loopPeer,buffer,sizeof(buffer),MSG_DONTWAIT);
+    return (size > 0) ? size : 0;
+  };
+  bool result = (loopPeer != -1) && (::write(loopPeer,"w",1) == 1);
+  // Poll until the request has been handled, then look at the peer without polling again
+  while (result && (loopRequests == 0)) {
+    epoll.poll(10);
   }
+  result = result && !loopSeen && (pending() == 1000);
+  result = result && loopSession;
+  if (result) {
+    thread([]{ loopSession->write("thread",6); }).join();
+    result = (pending() == 0) && pollUntil(epoll,[&]{ return pending() == 6; });
+  }
+  result = result && (::write(loopPeer,"q",1) == 1) && pollUntil(epoll,[&]{ return server.sessionCount() == 0; });
+  ::close(loopPeer);
+  server.stop();
+  return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int disconnects = 0;
+
+/** @brief A session that counts the calls to disconnect() */
+class CountingSession : public Session {
+  public:
+    CountingSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {}
+    void disconnect() override {
+      ++disconnects;
+      Session::disconnect();
+    }
+  protected:
+    void dataAvailable() override {
+      consume(available());
+    }
+};
+
+/** @brief Checks that a session leaves the server as soon as it disconnects
+ *  @details A session disconnected off its polling thread is freed by a task that the next poll() runs.
+ *           Until then withSession() and forEachSession() must not find it, and stop() must not 
+ *           disconnect it again. */
+int closedSessions() {
+  EPoll epoll;
+  TestServer<CountingSession> server(epoll);
+  server.start(1298,string("127.0.0.1"));
+  int fd = connectTo(1298);
+  bool result = (fd != -1) && pollUntil(epoll,[&]{ return server.sessionCount() == 1; });
+  Session *session = nullptr;
+  server.forEachSession([&](Session &s){ session = &s; });
+  SessionHandle handle = session ? session->handle() : SessionHandle();
+  bool connected = false;
+  result = result && server.withSession(handle,[&](Session &s){ connected = s.connected(); }) && connected;
+  if (result) {
+    thread([=]{ session->disconnect(); }).join();
+    size_t visited = 0;
+    server.forEachSession([&](Session&){ ++visited; });
+    result = !server.withSession(handle,[](Session&){}) && (visited == 0) && (server.sessionCount() == 0);
+  }
+  server.stop();
+  ::close(fd);
+  return (result && (disconnects == 1)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int poolCreated = 0;
+int poolDeleted = 0;
+int poolResets = 0;
+int poolDisconnects = 0;
+
+/** @brief A session that answers each request with the number of bytes it has received, cleared by reset() */
+class PoolSession : public Session {
+  public:
+    PoolSession(EPoll &epoll, Server &server, const int socket, const struct sockaddr_in peer_addr) : Session(epoll,server,socket,peer_addr) {
+      ++poolCreated;
+    }
+    ~PoolSession() { ++poolDeleted; }
+    void disconnect() override {
+      ++poolDisconnects;
+      Session::disconnect();
+    }
+  protected:
+    void dataAvailable() override {
+      size_t size = available();
+      consume(size);
+      received_ += size;
+      write(&received_,1);
+    }
+    void reset() override {
+      ++poolResets;
+      received_ = 0;
+    }
+  private:
+    uint8_t received_ {0};
+};
+
+/** @brief Checks that closed sessions are kept by the session pool and reused with their state reset
+ *  @details Each connection sends two bytes and expects the answer 2, which a reused session only gives
+ *           if reset() has run. A handle of an earlier connection must not name the reused session. 
+ *           Shrinking the pool deletes the surplus sessions, and stop() deletes the rest without 
+ *           disconnecting them again. */
+int sessionPool() {
+  EPoll epoll;
+  TestServer<PoolSession> server(epoll);
+  server.setSessionPoolSize(2);
+  server.start(1299,string("127.0.0.1"));
+  // Opens a connection, checks its answer and returns the session that served it
+  auto request = [&](int fd, Session *&session, SessionHandle &handle) {
+    uint8_t answer = 0;
+    bool result = (fd != -1) && (::write(fd,"ab",2) == 2) &&
+      pollUntil(epoll,[&]{ return ::recv(fd,&answer,1,MSG_DONTWAIT) == 1; }) && (answer == 2);
+    struct sockaddr_in local;
+    socklen_t length = sizeof(local);
+    getsockname(fd,(struct sockaddr*)&local,&length);
+    server.forEachSession([&](Session &s){
+      if (s.peer_port() == local.sin_port) {
+        session = &s;
+        handle = s.handle();
+      }
+    });
+    return result && session;
+  };
+  Session *first = nullptr;
+  SessionHandle firstHandle;
+  bool result = true;
+  for (int i=0;result && (i < 3);++i) {
+    int fd = connectTo(1299);
+    Session *session = nullptr;
+    SessionHandle handle;
+    result = request(fd,session,handle);
+    if (i == 0) {
+      first = session;
+      firstHandle = handle;
+    } else {
+      result = result && (session == first) && !server.withSession(firstHandle,[](Session&){});
+    }
+    ::close(fd);
+    result = result && pollUntil(epoll,[&]{ return server.pooledSessions() == 1; });
+  }
+  result = result && (poolCreated == 1) && (poolResets == 2);
+  // Two connections at once take the pooled session and a new one
+  int fds[2] = {connectTo(1299),connectTo(1299)};
+  for (int i=0;result && (i < 2);++i) {
+    Session *session = nullptr;
+    SessionHandle handle;
+    result = request(fds[i],session,handle);
+  }
+  ::close(fds[0]);
+  ::close(fds[1]);
+  result = result && (poolCreated == 2) && pollUntil(epoll,[&]{ return server.pooledSessions() == 2; });
+  server.setSessionPoolSize(1);
+  result = result && (server.pooledSessions() == 1) && (poolDeleted == 1);
+  server.stop();
+  return (result && (poolDeleted == 2) && (poolDisconnects == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char** argv) {
@@ -53,8 +1723,37 @@ int main(int argc, char** argv) {
     if (strcmp(argv[1],"createClient") == 0) return createClient();
     if (strcmp(argv[1],"destroyServer") == 0) return destroyServer();
     if (strcmp(argv[1],"destroyClient") == 0) return destroyClient();
+    if (strcmp(argv[1],"byteBuffer") == 0) return byteBuffer();
+    if (strcmp(argv[1],"framedMessages") == 0) return framedMessages();
+    if (strcmp(argv[1],"framedPartial") == 0) return framedPartial();
+    if (strcmp(argv[1],"frameTooLarge") == 0) return frameTooLarge();
+    if (strcmp(argv[1],"findByte") == 0) return findByte();
+    if (strcmp(argv[1],"delimitedRecords") == 0) return delimitedRecords();
+    if (strcmp(argv[1],"recordTooLarge") == 0) return recordTooLarge();
+    if (strcmp(argv[1],"slotMapGenerations") == 0) return slotMapGenerations();
+    if (strcmp(argv[1],"timerWheel") == 0) return timerWheel();
+    if (strcmp(argv[1],"postWake") == 0) return postWake();
+    if (strcmp(argv[1],"edgeTriggeredEcho") == 0) return edgeTriggeredEcho();
+    if (strcmp(argv[1],"ioUringEcho") == 0) return ioUringEcho();
+    if (strcmp(argv[1],"largeTransfer") == 0) return largeTransfer();
+    if (strcmp(argv[1],"zeroCopyLinger") == 0) return zeroCopyLinger();
+    if (strcmp(argv[1],"acceptBatch") == 0) return acceptBatch();
+    if (strcmp(argv[1],"workerDestroy") == 0) return workerDestroy();
+    if (strcmp(argv[1],"uncorkLatency") == 0) return uncorkLatency();
+    if (strcmp(argv[1],"balancePolicy") == 0) return balancePolicy();
+    if (strcmp(argv[1],"shardedListeners") == 0) return shardedListeners();
+    if (strcmp(argv[1],"sharedBuffer") == 0) return sharedBuffer();
+    if (strcmp(argv[1],"viewConsume") == 0) return viewConsume();
+    if (strcmp(argv[1],"blockPool") == 0) return blockPool();
+    if (strcmp(argv[1],"sendFileRegions") == 0) return sendFileRegions();
+    if (strcmp(argv[1],"watermarks") == 0) return watermarks();
+    if (strcmp(argv[1],"writeThrough") == 0) return writeThrough();
+    if (strcmp(argv[1],"endOfLoop") == 0) return endOfLoop();
+    if (strcmp(argv[1],"closedSessions") == 0) return closedSessions();
+    if (strcmp(argv[1],"sessionPool") == 0) return sessionPool();
+    cerr << "Unknown test " << argv[1] << endl;
   } else {
     cerr << "Invalid number of arguments" << endl;
-    return EXIT_FAILURE;
   }
-}
\ No newline at end of file
+  return EXIT_FAILURE;
+}